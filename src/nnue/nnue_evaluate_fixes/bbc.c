@@ -86,10 +86,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #ifdef WIN64
     #include <windows.h>
 #else
-    # include <sys/time.h>
+    #include <time.h>
+#endif
+
+// PEXT slider attacks backend (x86-64 only, build with -DNO_PEXT to leave it out)
+#if defined(__x86_64__) && !defined(NO_PEXT)
+    #define USE_PEXT
+    #include <cpuid.h>
 #endif
 
 // include NNUE wrapper header
@@ -98,6 +106,13 @@
 // define version
 #define version "1.2"
 
+// define NNUE file (the one embedded into the binary if any)
+#ifdef DefaultEvalFile
+#define nnue_file DefaultEvalFile
+#else
+#define nnue_file "nn-04cf2b4ed1da.nnue"
+#endif
+
 // define bitboard data type
 #define U64 unsigned long long
 
@@ -197,6 +212,22 @@ char promoted_pieces[] = {
     [n] = 'n'
 };
 
+// convert BBC piece code to Stockfish piece codes
+int nnue_pieces[12] = { 6, 5, 4, 3, 2, 1, 12, 11, 10, 9, 8, 7 };
+
+// convert BBC square indicies to Stockfish indicies (no square maps to NNUE's "off board" 64)
+int nnue_squares[65] = {
+    a1, b1, c1, d1, e1, f1, g1, h1,
+	a2, b2, c2, d2, e2, f2, g2, h2,
+	a3, b3, c3, d3, e3, f3, g3, h3,
+	a4, b4, c4, d4, e4, f4, g4, h4,
+	a5, b5, c5, d5, e5, f5, g5, h5,
+	a6, b6, c6, d6, e6, f6, g6, h6,
+	a7, b7, c7, d7, e7, f7, g7, h7,
+	a8, b8, c8, d8, e8, f8, g8, h8,
+    64
+};
+
 
 /**********************************\
  ==================================
@@ -301,32 +332,80 @@ char promoted_pieces[] = {
 
 */
 
+/*
+    Board state and search data are thread local, so every
+    search thread (see Lazy SMP) works on its own copy of them
+*/
+
 // piece bitboards
-U64 bitboards[12];
+_Thread_local U64 bitboards[12];
 
 // occupancy bitboards
-U64 occupancies[3];
+_Thread_local U64 occupancies[3];
+
+// piece on square (-1 if empty) kept in sync with bitboards
+_Thread_local int board[64];
 
 // side to move
-int side;
+_Thread_local int side;
 
 // enpassant square
-int enpassant = no_sq; 
+_Thread_local int enpassant = no_sq; 
 
 // castling rights
-int castle;
+_Thread_local int castle;
 
 // "almost" unique position identifier aka hash key or position key
-U64 hash_key;
+_Thread_local U64 hash_key;
+
+// hash key of pawns only (pawn structure identifier)
+_Thread_local U64 pawn_key;
+
+// hash key of piece counts (material signature)
+_Thread_local U64 material_key;
+
+// material & piece-square score [game phase] from white's point of view kept in sync with bitboards
+_Thread_local int psq_score[2];
 
-// positions repetition table
-U64 repetition_table[1000];  // 1000 is a number of plies (500 moves) in the entire game
+// game phase score (see get_game_phase_score()) kept in sync with bitboards
+_Thread_local int phase_score;
 
-// repetition index
-int repetition_index;
+// material & piece-square score [game phase][piece][square] (see init_psq_table())
+int psq_table[2][12][64];
+
+// game phase score of a piece [piece]
+int phase_table[12];
+
+// undo record of the move made on chess board
+typedef struct {
+    int move;       // move made (0 for null move)
+    int captured;   // captured piece (-1 if none)
+    int enpassant;  // enpassant square before the move
+    int castle;     // castling rights before the move
+    U64 hash_key;   // hash key before the move (used to detect repetitions)
+    U64 pawn_key;   // pawn hash key before the move
+    U64 material_key;   // material key before the move
+    int psq_score[2];   // material & piece-square score before the move
+    int phase_score;    // game phase score before the move
+} undo;
+
+// undo stack (positions repetition table)
+_Thread_local undo undo_stack[1000];  // 1000 is a number of plies (500 moves) in the entire game
+
+// repetition index (top of the undo stack)
+_Thread_local int repetition_index;
 
 // half move counter
-int ply;
+_Thread_local int ply;
+
+// max ply that we can reach within a search
+#define max_ply 64
+
+// NNUE accumulators & dirty pieces [ply]
+_Thread_local NNUEdata nnue_stack[max_ply + 1];
+
+// search thread index (main thread talking to the GUI is 0)
+_Thread_local int thread_id;
 
 
 /**********************************\
@@ -337,17 +416,14 @@ int ply;
  ==================================
 \**********************************/
 
-// exit from engine flag
-int quit = 0;
-
 // UCI "movestogo" command moves counter
 int movestogo = 30;
 
 // UCI "movetime" command time counter
 int movetime = -1;
 
-// UCI "time" command holder (ms)
-int time = -1;
+// UCI "time" command holder (ms), named so it does not shadow time() from <time.h>
+int uci_time = -1;
 
 // UCI "inc" command's time increment holder
 int inc = 0;
@@ -361,8 +437,11 @@ int stoptime = 0;
 // variable to flag time control availability
 int timeset = 0;
 
-// variable to flag when the time is up
-int stopped = 0;
+// variable to flag search is pondering (time control is on hold until "ponderhit")
+atomic_int pondering = 0;
+
+// variable to flag when the time is up or GUI said "stop" (shared by all search threads)
+atomic_int stopped = 0;
 
 
 /**********************************\
@@ -375,129 +454,234 @@ int stopped = 0;
  ==================================
 \**********************************/
 
-// get time in milliseconds
+// get time in milliseconds (monotonic clock, not affected by system time changes)
 int get_time_ms()
 {
     #ifdef WIN64
         return GetTickCount();
     #else
-        struct timeval time_value;
-        gettimeofday(&time_value, NULL);
-        return time_value.tv_sec * 1000 + time_value.tv_usec / 1000;
+        struct timespec time_value;
+        clock_gettime(CLOCK_MONOTONIC, &time_value);
+        return time_value.tv_sec * 1000 + time_value.tv_nsec / 1000000;
     #endif
 }
 
 /*
 
-  Function to "listen" to GUI's input during search.
-  It's waiting for the user input from STDIN.
-  OS dependent.
-  
-  First Richard Allbert aka BluefeverSoftware grabbed it from somewhere...
-  And then Code Monkey King has grabbed it from VICE)
-  
+  GUI/user input is read by a dedicated thread, so the search
+  never polls STDIN. "stop", "quit", "ponderhit" and "isready"
+  are handled by the input thread itself while searching,
+  everything else is queued for the UCI loop.
+
 */
-  
-int input_waiting()
+
+// max number of queued GUI/user commands
+#define input_queue_size 64
+
+// max length of GUI/user command
+#define input_size 2000
+
+// queued GUI/user commands
+char input_queue[input_queue_size][input_size];
+
+// indices of the next command to read & queue
+int input_head = 0, input_tail = 0;
+
+// number of "go" commands queued so far
+int go_commands = 0;
+
+// number of "go" commands the last "stop" applies to
+int stopped_go_commands = 0;
+
+// number of "go" commands the last "ponderhit" applies to
+int ponderhit_go_commands = 0;
+
+// flag search is running on behalf of "go" command
+int searching = 0;
+
+// lock & signal guarding the input queue and search flags above
+pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t input_changed = PTHREAD_COND_INITIALIZER;
+
+// queue GUI/user command (waits while the queue is full)
+void queue_input(char *input)
 {
-    #ifndef WIN32
-        fd_set readfds;
-        struct timeval tv;
-        FD_ZERO (&readfds);
-        FD_SET (fileno(stdin), &readfds);
-        tv.tv_sec=0; tv.tv_usec=0;
-        select(16, &readfds, 0, 0, &tv);
-
-        return (FD_ISSET(fileno(stdin), &readfds));
-    #else
-        static int init = 0, pipe;
-        static HANDLE inh;
-        DWORD dw;
+    // wait for a free slot
+    while (input_tail - input_head == input_queue_size)
+        pthread_cond_wait(&input_changed, &input_lock);
+    
+    // copy command
+    strcpy(input_queue[input_tail % input_queue_size], input);
+    input_tail++;
+    
+    // wake up the UCI loop
+    pthread_cond_broadcast(&input_changed);
+}
 
-        if (!init)
+// read GUI/user input (input thread entry point)
+void *read_input(void *arg)
+{
+    (void)arg;
+    
+    // GUI/user input
+    char input[input_size];
+    
+    // loop over input lines
+    while (fgets(input, input_size, stdin))
+    {
+        pthread_mutex_lock(&input_lock);
+        
+        // match UCI "stop" command
+        if (strncmp(input, "stop", 4) == 0)
         {
-            init = 1;
-            inh = GetStdHandle(STD_INPUT_HANDLE);
-            pipe = !GetConsoleMode(inh, &dw);
-            if (!pipe)
-            {
-                SetConsoleMode(inh, dw & ~(ENABLE_MOUSE_INPUT|ENABLE_WINDOW_INPUT));
-                FlushConsoleInputBuffer(inh);
-            }
+            // stop current search and the ones still queued
+            stopped_go_commands = go_commands;
+            if (searching) stopped = 1;
+            
+            // wake up search waiting for "ponderhit"
+            pthread_cond_broadcast(&input_changed);
         }
         
-        if (pipe)
+        // match UCI "ponderhit" command
+        else if (strncmp(input, "ponderhit", 9) == 0)
         {
-           if (!PeekNamedPipe(inh, NULL, 0, NULL, &dw, NULL)) return 1;
-           return dw;
+            // opponent played the expected move
+            ponderhit_go_commands = go_commands;
+            
+            // switch current search to the real clock
+            if (searching && pondering)
+            {
+                // time control starts now
+                int now = get_time_ms();
+                stoptime += now - starttime;
+                starttime = now;
+                
+                // let search check the time
+                pondering = 0;
+                
+                // wake up search waiting for "ponderhit"
+                pthread_cond_broadcast(&input_changed);
+            }
         }
         
+        // match UCI "isready" command while searching
+        else if (strncmp(input, "isready", 7) == 0 && searching)
+            // engine is responsive, UCI loop is busy though
+            printf("readyok\n");
+        
+        // any other command goes to the UCI loop
         else
         {
-           GetNumberOfConsoleInputEvents(inh, &dw);
-           return dw <= 1 ? 0 : dw;
+            // match UCI "go" command
+            if (strncmp(input, "go", 2) == 0)
+                // count it for "stop" to know whether it was sent before or after
+                go_commands++;
+            
+            // match UCI "quit" command
+            if (strncmp(input, "quit", 4) == 0)
+            {
+                // stop searching as well
+                stopped_go_commands = go_commands;
+                if (searching) stopped = 1;
+                
+                // wake up search waiting for "ponderhit"
+                pthread_cond_broadcast(&input_changed);
+            }
+            
+            // queue command
+            queue_input(input);
         }
-
-    #endif
+        
+        pthread_mutex_unlock(&input_lock);
+        
+        // nothing is read after "quit"
+        if (strncmp(input, "quit", 4) == 0) return NULL;
+    }
+    
+    // end of input means "quit" once queued commands are done
+    pthread_mutex_lock(&input_lock);
+    queue_input("quit\n");
+    pthread_mutex_unlock(&input_lock);
+    
+    return NULL;
 }
 
-// read GUI/user input
-void read_input()
+// get next GUI/user command (waits until there is one)
+void get_input(char *input)
 {
-    // bytes to read holder
-    int bytes;
+    pthread_mutex_lock(&input_lock);
     
-    // GUI/user input
-    char input[256] = "", *endc;
+    // wait for a command
+    while (input_head == input_tail)
+        pthread_cond_wait(&input_changed, &input_lock);
+    
+    // copy command
+    strcpy(input, input_queue[input_head % input_queue_size]);
+    input_head++;
+    
+    // let input thread queue more commands
+    pthread_cond_broadcast(&input_changed);
+    
+    pthread_mutex_unlock(&input_lock);
+}
 
-    // "listen" to STDIN
-    if (input_waiting())
+// start or finish search on behalf of "go" command
+void set_searching(int flag)
+{
+    // number of "go" commands taken from the queue so far
+    static int searched_go_commands = 0;
+    
+    pthread_mutex_lock(&input_lock);
+    
+    // search is starting
+    if (flag)
     {
-        // tell engine to stop calculating
-        stopped = 1;
-        
-        // loop to read bytes from STDIN
-        do
-        {
-            // read bytes from STDIN
-            bytes=read(fileno(stdin), input, 256);
-        }
+        // "stop" may have come while "go" was still queued
+        searched_go_commands++;
+        stopped = stopped_go_commands >= searched_go_commands;
         
-        // until bytes available
-        while (bytes < 0);
-        
-        // searches for the first occurrence of '\n'
-        endc = strchr(input,'\n');
-        
-        // if found new line set value at pointer to 0
-        if (endc) *endc=0;
-        
-        // if input is available
-        if (strlen(input) > 0)
-        {
-            // match UCI "quit" command
-            if (!strncmp(input, "quit", 4))
-                // tell engine to terminate exacution    
-                quit = 1;
-
-            // // match UCI "stop" command
-            else if (!strncmp(input, "stop", 4))
-                // tell engine to terminate exacution
-                quit = 1;
-        }   
+        // so may have "ponderhit"
+        if (ponderhit_go_commands >= searched_go_commands) pondering = 0;
     }
+    
+    // search is done, stopped pondering search included
+    else pondering = 0;
+    
+    // input thread handles "stop" & "isready" while searching
+    searching = flag;
+    
+    pthread_mutex_unlock(&input_lock);
+}
+
+// wait until pondering search is told "ponderhit" or "stop"
+void wait_ponderhit()
+{
+    pthread_mutex_lock(&input_lock);
+    
+    // GUI expects no best move while pondering
+    while (pondering && !stopped)
+        pthread_cond_wait(&input_changed, &input_lock);
+    
+    pthread_mutex_unlock(&input_lock);
 }
 
-// a bridge function to interact between search and GUI input
-static void communicate() {
-	// if time is up break here
-    if(timeset == 1 && get_time_ms() > stoptime) {
+// publish helper thread node count (defined with search threads)
+void publish_nodes();
+
+// check whether the time is up
+static inline void check_time() {
+    // only main thread keeps track of time, helper threads just publish their node counts
+    if (thread_id)
+    {
+        publish_nodes();
+        return;
+    }
+    
+	// if time is up break here (the clock isn't running while pondering)
+    if(timeset == 1 && !pondering && get_time_ms() > stoptime) {
 		// tell engine to stop calculating
 		stopped = 1;
 	}
-	
-    // read GUI input
-	read_input();
 }
 
 
@@ -546,6 +730,21 @@ U64 get_random_U64_number()
     return n1 | (n2 << 16) | (n3 << 32) | (n4 << 48);
 }
 
+// pseudo random hash key state
+U64 random_key_state = 1070372ULL;
+
+// generate 64-bit pseudo random hash key
+U64 get_random_key()
+{
+    // XOR shift algorithm (64-bit state)
+    random_key_state ^= random_key_state >> 12;
+    random_key_state ^= random_key_state << 25;
+    random_key_state ^= random_key_state >> 27;
+    
+    // scramble the state (keys sliced from a 32-bit XOR shift are linearly dependent)
+    return random_key_state * 2685821657736338717ULL;
+}
+
 // generate magic number candidate
 U64 generate_magic_number()
 {
@@ -626,8 +825,8 @@ U64 side_key;
 // init random hash keys
 void init_random_keys()
 {
-    // update pseudo random number state
-    random_state = 1804289383;
+    // update pseudo random hash key state
+    random_key_state = 1070372ULL;
 
     // loop over piece codes
     for (int piece = P; piece <= k; piece++)
@@ -635,21 +834,21 @@ void init_random_keys()
         // loop over board squares
         for (int square = 0; square < 64; square++)
             // init random piece keys
-            piece_keys[piece][square] = get_random_U64_number();
+            piece_keys[piece][square] = get_random_key();
     }
     
     // loop over board squares
     for (int square = 0; square < 64; square++)
         // init random enpassant keys
-        enpassant_keys[square] = get_random_U64_number();
+        enpassant_keys[square] = get_random_key();
     
     // loop over castling keys
     for (int index = 0; index < 16; index++)
         // init castling keys
-        castle_keys[index] = get_random_U64_number();
+        castle_keys[index] = get_random_key();
         
     // init random side key
-    side_key = get_random_U64_number();
+    side_key = get_random_key();
 }
 
 // generate "almost" unique position ID aka hash key from scratch
@@ -696,6 +895,94 @@ U64 generate_hash_key()
     return final_key;
 }
 
+// generate pawn structure identifier from scratch
+U64 generate_pawn_key()
+{
+    // final pawn key
+    U64 final_key = 0ULL;
+    
+    // loop over pawn bitboards
+    for (int piece = P; piece <= p; piece += p - P)
+    {
+        // init pawn bitboard copy
+        U64 bitboard = bitboards[piece];
+        
+        // loop over pawns within a bitboard
+        while (bitboard)
+        {
+            // init square occupied by the pawn
+            int square = get_ls1b_index(bitboard);
+            
+            // hash pawn
+            final_key ^= piece_keys[piece][square];
+            
+            // pop LS1B
+            pop_bit(bitboard, square);
+        }
+    }
+    
+    // return generated pawn key
+    return final_key;
+}
+
+/*
+    Material key hashes piece counts rather than squares: the N-th piece
+    of a kind contributes piece_keys[piece][N - 1], so a capture only
+    removes the key of the last piece left of the captured kind
+*/
+
+// generate material signature from scratch
+U64 generate_material_key()
+{
+    // final material key
+    U64 final_key = 0ULL;
+    
+    // loop over piece bitboards
+    for (int piece = P; piece <= k; piece++)
+        // loop over piece count
+        for (int count = 0; count < count_bits(bitboards[piece]); count++)
+            // hash piece count
+            final_key ^= piece_keys[piece][count];
+    
+    // return generated material key
+    return final_key;
+}
+
+// compute material & piece-square score and game phase score from scratch
+void generate_psq_score()
+{
+    // temp piece bitboard copy
+    U64 bitboard;
+    
+    // reset scores
+    psq_score[0] = psq_score[1] = 0;
+    phase_score = 0;
+    
+    // loop over piece bitboards
+    for (int piece = P; piece <= k; piece++)
+    {
+        // init piece bitboard copy
+        bitboard = bitboards[piece];
+        
+        // loop over the pieces within a bitboard
+        while (bitboard)
+        {
+            // init square occupied by the piece
+            int square = get_ls1b_index(bitboard);
+            
+            // add piece score of both game phases
+            psq_score[0] += psq_table[0][piece][square];
+            psq_score[1] += psq_table[1][piece][square];
+            
+            // add piece game phase score
+            phase_score += phase_table[piece];
+            
+            // pop LS1B
+            pop_bit(bitboard, square);
+        }
+    }
+}
+
 
 /**********************************\
  ==================================
@@ -816,11 +1103,14 @@ void reset_board()
     enpassant = no_sq;
     castle = 0;
     
+    // reset piece on square array
+    memset(board, -1, sizeof(board));
+    
     // reset repetition index
     repetition_index = 0;
     
-    // reset repetition table
-    memset(repetition_table, 0ULL, sizeof(repetition_table));
+    // reset undo stack
+    memset(undo_stack, 0, sizeof(undo_stack));
 }
 
 // parse FEN string
@@ -847,6 +1137,9 @@ void parse_fen(char *fen)
                 // set piece on corresponding bitboard
                 set_bit(bitboards[piece], square);
                 
+                // set piece on square
+                board[square] = piece;
+                
                 // increment pointer to FEN string
                 fen++;
             }
@@ -947,6 +1240,18 @@ void parse_fen(char *fen)
     
     // init hash key
     hash_key = generate_hash_key();
+    
+    // init pawn key
+    pawn_key = generate_pawn_key();
+    
+    // init material key
+    material_key = generate_material_key();
+    
+    // init material & piece-square score
+    generate_psq_score();
+    
+    // NNUE accumulator has to be refreshed
+    nnue_stack[0].accumulator.computedAccumulation = 0;
 }
 
 
@@ -1011,6 +1316,13 @@ const int rook_relevant_bits[64] = {
     12, 11, 11, 11, 11, 11, 11, 12
 };
 
+#ifdef PRECOMPUTED_TABLES
+
+// magic numbers, attack tables & evaluation masks generated at build time (see print_tables())
+#include "tables.h"
+
+#else
+
 // rook magic numbers
 U64 rook_magic_numbers[64] = {
     0x8a80104000800020ULL,
@@ -1162,11 +1474,34 @@ U64 bishop_masks[64];
 // rook attack masks
 U64 rook_masks[64];
 
-// bishop attacks table [square][occupancies]
-U64 bishop_attacks[64][512];
+/*
+    Bishop & rook attacks of every square take 2 ^ relevant bits entries
+    and are packed one after another into a single table (5248 entries
+    for bishops, 102400 for rooks, 841 KB instead of 2304 KB when every
+    square reserves 512/4096 entries). Entries actually looked up are
+    the same either way, so packing saves address space and ~0.4 MB of
+    touched pages (unused slots of squares with fewer bits), not cache
+    lines: lookup speed is unchanged.
+*/
+
+// bishop & rook attacks table [square offset + occupancies]
+U64 slider_attacks[5248 + 102400];
+
+// offsets of square's bishop attacks in slider attacks table [square]
+int bishop_offsets[64];
+
+// offsets of square's rook attacks in slider attacks table [square]
+int rook_offsets[64];
+
+#ifdef USE_PEXT
+// slider attacks table indexed by PEXT of occupancy & relevant occupancy mask (same offsets)
+U64 pext_attacks[5248 + 102400];
+#endif
+
+// squares between two squares on the same rank, file or diagonal [square][square]
+U64 between_masks[64][64];
 
-// rook attacks rable [square][occupancies]
-U64 rook_attacks[64][4096];
+#endif
 
 // generate pawn attacks
 U64 mask_pawn_attacks(int side, int square)
@@ -1382,6 +1717,17 @@ U64 rook_attacks_on_the_fly(int square, U64 block)
     return attacks;
 }
 
+// slider attacks lookup backends (tables of both are initialized to print them)
+enum { magic_backend, pext_backend, all_backends };
+
+// slider attacks lookup backend names
+char *slider_backends[] = { "magic", "pext" };
+
+// slider attacks lookup backend in use
+int slider_backend = magic_backend;
+
+#ifndef PRECOMPUTED_TABLES
+
 // init leaper pieces attacks
 void init_leapers_attacks()
 {
@@ -1521,8 +1867,27 @@ void init_magic_numbers()
 }
 
 // init slider piece's attack tables
-void init_sliders_attacks(int bishop)
+void init_sliders_attacks(int bishop, int backend)
 {
+    // offset of the next square's attacks (bishops go first, rooks follow)
+    int offset = 0;
+    
+    // loop over 64 board squares
+    for (int square = 0; square < 64; square++)
+    {
+        // init bishop attacks offset
+        bishop_offsets[square] = offset;
+        offset += 1 << bishop_relevant_bits[square];
+    }
+    
+    // loop over 64 board squares
+    for (int square = 0; square < 64; square++)
+    {
+        // init rook attacks offset
+        rook_offsets[square] = offset;
+        offset += 1 << rook_relevant_bits[square];
+    }
+    
     // loop over 64 board squares
     for (int square = 0; square < 64; square++)
     {
@@ -1551,8 +1916,15 @@ void init_sliders_attacks(int bishop)
                 // init magic index
                 int magic_index = (occupancy * bishop_magic_numbers[square]) >> (64 - bishop_relevant_bits[square]);
                 
-                // init bishop attacks
-                bishop_attacks[square][magic_index] = bishop_attacks_on_the_fly(square, occupancy);
+                // init bishop attacks (only the table of the backend in use is filled)
+                if (backend != pext_backend)
+                    slider_attacks[bishop_offsets[square] + magic_index] = bishop_attacks_on_the_fly(square, occupancy);
+                
+                #ifdef USE_PEXT
+                // occupancy index is PEXT of the occupancy
+                if (backend != magic_backend)
+                    pext_attacks[bishop_offsets[square] + index] = bishop_attacks_on_the_fly(square, occupancy);
+                #endif
             }
             
             // rook
@@ -1564,68 +1936,157 @@ void init_sliders_attacks(int bishop)
                 // init magic index
                 int magic_index = (occupancy * rook_magic_numbers[square]) >> (64 - rook_relevant_bits[square]);
                 
-                // init rook attacks
-                rook_attacks[square][magic_index] = rook_attacks_on_the_fly(square, occupancy);
+                // init rook attacks (only the table of the backend in use is filled)
+                if (backend != pext_backend)
+                    slider_attacks[rook_offsets[square] + magic_index] = rook_attacks_on_the_fly(square, occupancy);
+                
+                #ifdef USE_PEXT
+                // occupancy index is PEXT of the occupancy
+                if (backend != magic_backend)
+                    pext_attacks[rook_offsets[square] + index] = rook_attacks_on_the_fly(square, occupancy);
+                #endif
             
             }
         }
     }
 }
 
+// init squares between two aligned squares
+void init_between_masks()
+{
+    // loop over square pairs
+    for (int square_1 = 0; square_1 < 64; square_1++)
+    {
+        for (int square_2 = 0; square_2 < 64; square_2++)
+        {
+            // init rank & file distance
+            int rank_distance = abs(square_1 / 8 - square_2 / 8);
+            int file_distance = abs(square_1 % 8 - square_2 % 8);
+            
+            // reset between mask
+            between_masks[square_1][square_2] = 0ULL;
+            
+            // same square
+            if (square_1 == square_2) continue;
+            
+            // same rank or file
+            if (rank_distance == 0 || file_distance == 0)
+                between_masks[square_1][square_2] = rook_attacks_on_the_fly(square_1, 1ULL << square_2) &
+                                                    rook_attacks_on_the_fly(square_2, 1ULL << square_1);
+            
+            // same diagonal
+            else if (rank_distance == file_distance)
+                between_masks[square_1][square_2] = bishop_attacks_on_the_fly(square_1, 1ULL << square_2) &
+                                                    bishop_attacks_on_the_fly(square_2, 1ULL << square_1);
+        }
+    }
+}
+
+#endif
+
+#ifdef USE_PEXT
+// parallel bits extract (inline asm so that the rest of the engine runs on CPUs without BMI2)
+static inline U64 pext(U64 source, U64 mask)
+{
+    U64 result;
+    __asm__("pextq %2, %1, %0" : "=r" (result) : "r" (source), "r" (mask));
+    return result;
+}
+#endif
+
+// CPU supports PEXT at all
+int pext_supported()
+{
+#ifdef USE_PEXT
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+#else
+    return 0;
+#endif
+}
+
+// PEXT is faster than magic multiply-shift on the CPU
+int pext_fast()
+{
+#ifdef USE_PEXT
+    // no BMI2
+    if (!pext_supported()) return 0;
+    
+    // init CPU vendor & family (unknown CPU: trust BMI2 flag)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return 1;
+    int amd = ebx == 0x68747541;  // "Auth(enticAMD)"
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 1;
+    int family = (eax >> 8) & 0xf;
+    if (family == 0xf) family += (eax >> 20) & 0xff;
+    
+    // AMD CPUs before Zen 3 (family 19h) run PEXT in microcode
+    return !(amd && family < 0x19);
+#else
+    return 0;
+#endif
+}
+
+// switch slider attacks backend
+void set_slider_backend(int backend)
+{
+#ifndef PRECOMPUTED_TABLES
+    // fill the table of the new backend
+    if (backend != slider_backend)
+    {
+        init_sliders_attacks(bishop, backend);
+        init_sliders_attacks(rook, backend);
+    }
+#endif
+    
+    // use it from now on
+    slider_backend = backend;
+    
+    // report backend in use
+    printf("info string slider attacks using %s\n", slider_backends[slider_backend]);
+}
+
 // get bishop attacks
 static inline U64 get_bishop_attacks(int square, U64 occupancy)
 {
+#ifdef USE_PEXT
+    // PEXT indexed attacks
+    if (slider_backend == pext_backend)
+        return pext_attacks[bishop_offsets[square] + pext(occupancy, bishop_masks[square])];
+#endif
+    
     // get bishop attacks assuming current board occupancy
     occupancy &= bishop_masks[square];
     occupancy *= bishop_magic_numbers[square];
     occupancy >>= 64 - bishop_relevant_bits[square];
     
     // return bishop attacks
-    return bishop_attacks[square][occupancy];
+    return slider_attacks[bishop_offsets[square] + occupancy];
 }
 
 // get rook attacks
 static inline U64 get_rook_attacks(int square, U64 occupancy)
 {
+#ifdef USE_PEXT
+    // PEXT indexed attacks
+    if (slider_backend == pext_backend)
+        return pext_attacks[rook_offsets[square] + pext(occupancy, rook_masks[square])];
+#endif
+    
     // get rook attacks assuming current board occupancy
     occupancy &= rook_masks[square];
     occupancy *= rook_magic_numbers[square];
     occupancy >>= 64 - rook_relevant_bits[square];
     
     // return rook attacks
-    return rook_attacks[square][occupancy];
+    return slider_attacks[rook_offsets[square] + occupancy];
 }
 
 // get queen attacks
 static inline U64 get_queen_attacks(int square, U64 occupancy)
 {
-    // init result attacks bitboard
-    U64 queen_attacks = 0ULL;
-    
-    // init bishop occupancies
-    U64 bishop_occupancy = occupancy;
-    
-    // init rook occupancies
-    U64 rook_occupancy = occupancy;
-    
-    // get bishop attacks assuming current board occupancy
-    bishop_occupancy &= bishop_masks[square];
-    bishop_occupancy *= bishop_magic_numbers[square];
-    bishop_occupancy >>= 64 - bishop_relevant_bits[square];
-    
-    // get bishop attacks
-    queen_attacks = bishop_attacks[square][bishop_occupancy];
-    
-    // get rook attacks assuming current board occupancy
-    rook_occupancy &= rook_masks[square];
-    rook_occupancy *= rook_magic_numbers[square];
-    rook_occupancy >>= 64 - rook_relevant_bits[square];
-    
-    // get rook attacks
-    queen_attacks |= rook_attacks[square][rook_occupancy];
-    
-    // return queen attacks
-    return queen_attacks;
+    // queen attacks like bishop and rook together
+    return get_bishop_attacks(square, occupancy) | get_rook_attacks(square, occupancy);
 }
 
 
@@ -1665,6 +2126,26 @@ static inline int is_square_attacked(int square, int side)
     return 0;
 }
 
+// get pieces of the given side attacking the square
+static inline U64 get_attackers(int square, int side)
+{
+    // white attackers
+    if (side == white)
+        return (pawn_attacks[black][square] & bitboards[P]) |
+               (knight_attacks[square] & bitboards[N]) |
+               (get_bishop_attacks(square, occupancies[both]) & (bitboards[B] | bitboards[Q])) |
+               (get_rook_attacks(square, occupancies[both]) & (bitboards[R] | bitboards[Q])) |
+               (king_attacks[square] & bitboards[K]);
+    
+    // black attackers
+    else
+        return (pawn_attacks[white][square] & bitboards[p]) |
+               (knight_attacks[square] & bitboards[n]) |
+               (get_bishop_attacks(square, occupancies[both]) & (bitboards[b] | bitboards[q])) |
+               (get_rook_attacks(square, occupancies[both]) & (bitboards[r] | bitboards[q])) |
+               (king_attacks[square] & bitboards[k]);
+}
+
 // print attacked squares
 void print_attacked_squares(int side)
 {
@@ -1710,14 +2191,16 @@ void print_attacked_squares(int side)
 
 // encode move
 #define encode_move(source, target, piece, promoted, capture, double, enpassant, castling) \
-    (source) |          \
-    (target << 6) |     \
-    (piece << 12) |     \
-    (promoted << 16) |  \
-    (capture << 20) |   \
-    (double << 21) |    \
-    (enpassant << 22) | \
-    (castling << 23)    \
+    (                       \
+     (source) |             \
+     ((target) << 6) |      \
+     ((piece) << 12) |      \
+     ((promoted) << 16) |   \
+     ((capture) << 20) |    \
+     ((double) << 21) |     \
+     ((enpassant) << 22) |  \
+     ((castling) << 23)     \
+    )
     
 // extract source square
 #define get_move_source(move) (move & 0x3f)
@@ -1822,25 +2305,12 @@ void print_move_list(moves *move_list)
 
 }
 
-// preserve board state
-#define copy_board()                                                      \
-    U64 bitboards_copy[12], occupancies_copy[3];                          \
-    int side_copy, enpassant_copy, castle_copy;                           \
-    memcpy(bitboards_copy, bitboards, 96);                                \
-    memcpy(occupancies_copy, occupancies, 24);                            \
-    side_copy = side, enpassant_copy = enpassant, castle_copy = castle;   \
-    U64 hash_key_copy = hash_key;                                         \
-
-// restore board state
-#define take_back()                                                       \
-    memcpy(bitboards, bitboards_copy, 96);                                \
-    memcpy(occupancies, occupancies_copy, 24);                            \
-    side = side_copy, enpassant = enpassant_copy, castle = castle_copy;   \
-    hash_key = hash_key_copy;                                             \
-
 // move types
 enum { all_moves, only_captures };
 
+// move generation types
+enum { generate_all, generate_captures, generate_quiets, generate_evasions };
+
 /*
                            castling   move     in      in
                               right update     binary  decimal
@@ -1869,14 +2339,144 @@ const int castling_rights[64] = {
     13, 15, 15, 15, 12, 15, 15, 14
 };
 
+// add piece moved from/to square (no_sq when it leaves/enters the board) to NNUE dirty pieces
+static inline void add_dirty_piece(int piece, int from, int to)
+{
+    // init dirty pieces of the current ply
+    DirtyPiece *dirty_piece = &nnue_stack[ply].dirtyPiece;
+    
+    // store piece and squares converted to Stockfish codes
+    dirty_piece->pc[dirty_piece->dirtyNum] = nnue_pieces[piece];
+    dirty_piece->from[dirty_piece->dirtyNum] = nnue_squares[from];
+    dirty_piece->to[dirty_piece->dirtyNum] = nnue_squares[to];
+    
+    // increment dirty pieces count
+    dirty_piece->dirtyNum++;
+}
+
+// move piece from/to square (no_sq when it leaves/enters the board) in material & piece-square score
+static inline void move_psq_score(int piece, int from, int to)
+{
+    // remove piece from the source square
+    if (from != no_sq)
+    {
+        psq_score[0] -= psq_table[0][piece][from];
+        psq_score[1] -= psq_table[1][piece][from];
+    }
+    
+    // piece enters the board
+    else phase_score += phase_table[piece];
+    
+    // put piece on the target square
+    if (to != no_sq)
+    {
+        psq_score[0] += psq_table[0][piece][to];
+        psq_score[1] += psq_table[1][piece][to];
+    }
+    
+    // piece leaves the board
+    else phase_score -= phase_table[piece];
+}
+
+// take move back restoring board state from the undo stack
+static inline void unmake_move()
+{
+    // pick up undo record of the last move
+    undo *undo_info = &undo_stack[repetition_index];
+    
+    // parse move
+    int move = undo_info->move;
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int piece = get_move_piece(move);
+    int promoted_piece = get_move_promoted(move);
+    int enpass = get_move_enpassant(move);
+    int castling = get_move_castling(move);
+    
+    // change side back to the one who made the move
+    side ^= 1;
+    
+    // remove piece (or promoted piece) from the target square
+    pop_bit(bitboards[promoted_piece ? promoted_piece : piece], target_square);
+    pop_bit(occupancies[side], target_square);
+    board[target_square] = -1;
+    
+    // put piece back to the source square
+    set_bit(bitboards[piece], source_square);
+    set_bit(occupancies[side], source_square);
+    board[source_square] = piece;
+    
+    // restore captured piece
+    if (undo_info->captured != -1)
+    {
+        // enpassant captured pawn stands behind the target square
+        int capture_square = enpass ? ((side == white) ? target_square + 8 : target_square - 8) : target_square;
+        
+        // put captured piece back
+        set_bit(bitboards[undo_info->captured], capture_square);
+        set_bit(occupancies[side ^ 1], capture_square);
+        board[capture_square] = undo_info->captured;
+    }
+    
+    // move rook back on castling
+    if (castling)
+    {
+        // init rook and its squares
+        int rook_piece, rook_source, rook_target;
+        
+        // switch target square
+        switch (target_square)
+        {
+            case (g1): rook_piece = R; rook_source = h1; rook_target = f1; break;
+            case (c1): rook_piece = R; rook_source = a1; rook_target = d1; break;
+            case (g8): rook_piece = r; rook_source = h8; rook_target = f8; break;
+            default:   rook_piece = r; rook_source = a8; rook_target = d8; break;
+        }
+        
+        // move rook back
+        pop_bit(bitboards[rook_piece], rook_target);
+        set_bit(bitboards[rook_piece], rook_source);
+        pop_bit(occupancies[side], rook_target);
+        set_bit(occupancies[side], rook_source);
+        board[rook_target] = -1;
+        board[rook_source] = rook_piece;
+    }
+    
+    // update both sides occupancies
+    occupancies[both] = occupancies[white] | occupancies[black];
+    
+    // restore irreversible state
+    enpassant = undo_info->enpassant;
+    castle = undo_info->castle;
+    hash_key = undo_info->hash_key;
+    pawn_key = undo_info->pawn_key;
+    material_key = undo_info->material_key;
+    psq_score[0] = undo_info->psq_score[0];
+    psq_score[1] = undo_info->psq_score[1];
+    phase_score = undo_info->phase_score;
+    
+    // pop undo record
+    repetition_index--;
+}
+
 // make move on chess board
 static inline int make_move(int move, int move_flag)
 {
     // quiet moves
     if (move_flag == all_moves)
     {
-        // preserve board state
-        copy_board();
+        // push undo record preserving irreversible board state
+        undo *undo_info = &undo_stack[++repetition_index];
+        undo_info->move = move;
+        undo_info->captured = -1;
+        undo_info->enpassant = enpassant;
+        undo_info->castle = castle;
+        undo_info->hash_key = hash_key;
+        undo_info->pawn_key = pawn_key;
+        undo_info->material_key = material_key;
+        undo_info->psq_score[0] = psq_score[0];
+        undo_info->psq_score[1] = psq_score[1];
+        undo_info->phase_score = phase_score;
         
         // parse move
         int source_square = get_move_source(move);
@@ -1892,46 +2492,65 @@ static inline int make_move(int move, int move_flag)
         pop_bit(bitboards[piece], source_square);
         set_bit(bitboards[piece], target_square);
         
+        // update occupancies
+        pop_bit(occupancies[side], source_square);
+        set_bit(occupancies[side], target_square);
+        
         // hash piece
         hash_key ^= piece_keys[piece][source_square]; // remove piece from source square in hash key
         hash_key ^= piece_keys[piece][target_square]; // set piece to the target square in hash key
         
-        // handling capture moves
-        if (capture)
+        // hash pawn structure
+        if (piece == P || piece == p)
+        {
+            pawn_key ^= piece_keys[piece][source_square];
+            pawn_key ^= piece_keys[piece][target_square];
+        }
+        
+        // update material & piece-square score
+        move_psq_score(piece, source_square, target_square);
+        
+        // NNUE accumulator of the current ply needs to be updated
+        nnue_stack[ply].accumulator.computedAccumulation = 0;
+        nnue_stack[ply].dirtyPiece.dirtyNum = 0;
+        
+        // moving piece goes first (on king moves accumulator gets refreshed)
+        add_dirty_piece(piece, source_square, target_square);
+        
+        // handling capture moves (enpassant target square is empty)
+        if (capture && board[target_square] != -1)
         {
-            // pick up bitboard piece index ranges depending on side
-            int start_piece, end_piece;
+            // pick up captured piece
+            int captured_piece = board[target_square];
             
-            // white to move
-            if (side == white)
-            {
-                start_piece = p;
-                end_piece = k;
-            }
+            // remove it from corresponding bitboard
+            pop_bit(bitboards[captured_piece], target_square);
+            pop_bit(occupancies[side ^ 1], target_square);
             
-            // black to move
-            else
-            {
-                start_piece = P;
-                end_piece = K;
-            }
+            // remove the piece from hash key
+            hash_key ^= piece_keys[captured_piece][target_square];
             
-            // loop over bitboards opposite to the current side to move
-            for (int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
-            {
-                // if there's a piece on the target square
-                if (get_bit(bitboards[bb_piece], target_square))
-                {
-                    // remove it from corresponding bitboard
-                    pop_bit(bitboards[bb_piece], target_square);
-                    
-                    // remove the piece from hash key
-                    hash_key ^= piece_keys[bb_piece][target_square];
-                    break;
-                }
-            }
+            // remove captured pawn from pawn key
+            if (captured_piece == P || captured_piece == p)
+                pawn_key ^= piece_keys[captured_piece][target_square];
+            
+            // remove captured piece from material key
+            material_key ^= piece_keys[captured_piece][count_bits(bitboards[captured_piece])];
+            
+            // remove the piece from material & piece-square score
+            move_psq_score(captured_piece, target_square, no_sq);
+            
+            // remove captured piece from NNUE accumulator
+            add_dirty_piece(captured_piece, target_square, no_sq);
+            
+            // store captured piece to put it back on unmake
+            undo_info->captured = captured_piece;
         }
         
+        // move piece on square array (captured piece gets overwritten)
+        board[source_square] = -1;
+        board[target_square] = promoted_piece ? promoted_piece : piece;
+        
         // handle pawn promotions
         if (promoted_piece)
         {
@@ -1943,6 +2562,8 @@ static inline int make_move(int move, int move_flag)
                 
                 // remove pawn from hash key
                 hash_key ^= piece_keys[P][target_square];
+                pawn_key ^= piece_keys[P][target_square];
+                material_key ^= piece_keys[P][count_bits(bitboards[P])];
             }
             
             // black to move
@@ -1953,6 +2574,8 @@ static inline int make_move(int move, int move_flag)
                 
                 // remove pawn from hash key
                 hash_key ^= piece_keys[p][target_square];
+                pawn_key ^= piece_keys[p][target_square];
+                material_key ^= piece_keys[p][count_bits(bitboards[p])];
             }
             
             // set up promoted piece on chess board
@@ -1960,23 +2583,41 @@ static inline int make_move(int move, int move_flag)
             
             // add promoted piece into the hash key
             hash_key ^= piece_keys[promoted_piece][target_square];
+            material_key ^= piece_keys[promoted_piece][count_bits(bitboards[promoted_piece]) - 1];
+            
+            // replace pawn with promoted piece in material & piece-square score
+            move_psq_score(side == white ? P : p, target_square, no_sq);
+            move_psq_score(promoted_piece, no_sq, target_square);
+            
+            // pawn doesn't reach the target square, promoted piece does
+            nnue_stack[ply].dirtyPiece.to[0] = nnue_squares[no_sq];
+            add_dirty_piece(promoted_piece, no_sq, target_square);
         }
         
         // handle enpassant captures
         if (enpass)
         {
-            // erase the pawn depending on side to move
-            (side == white) ? pop_bit(bitboards[p], target_square + 8) :
-                              pop_bit(bitboards[P], target_square - 8);
-                              
             // white to move
             if (side == white)
             {
                 // remove captured pawn
                 pop_bit(bitboards[p], target_square + 8);
+                pop_bit(occupancies[black], target_square + 8);
+                board[target_square + 8] = -1;
                 
                 // remove pawn from hash key
                 hash_key ^= piece_keys[p][target_square + 8];
+                pawn_key ^= piece_keys[p][target_square + 8];
+                material_key ^= piece_keys[p][count_bits(bitboards[p])];
+                
+                // remove pawn from material & piece-square score
+                move_psq_score(p, target_square + 8, no_sq);
+                
+                // remove pawn from NNUE accumulator
+                add_dirty_piece(p, target_square + 8, no_sq);
+                
+                // store captured pawn to put it back on unmake
+                undo_info->captured = p;
             }
             
             // black to move
@@ -1984,9 +2625,22 @@ static inline int make_move(int move, int move_flag)
             {
                 // remove captured pawn
                 pop_bit(bitboards[P], target_square - 8);
+                pop_bit(occupancies[white], target_square - 8);
+                board[target_square - 8] = -1;
                 
                 // remove pawn from hash key
                 hash_key ^= piece_keys[P][target_square - 8];
+                pawn_key ^= piece_keys[P][target_square - 8];
+                material_key ^= piece_keys[P][count_bits(bitboards[P])];
+                
+                // remove pawn from material & piece-square score
+                move_psq_score(P, target_square - 8, no_sq);
+                
+                // remove pawn from NNUE accumulator
+                add_dirty_piece(P, target_square - 8, no_sq);
+                
+                // store captured pawn to put it back on unmake
+                undo_info->captured = P;
             }
         }
         
@@ -2031,10 +2685,20 @@ static inline int make_move(int move, int move_flag)
                     // move H rook
                     pop_bit(bitboards[R], h1);
                     set_bit(bitboards[R], f1);
+                    pop_bit(occupancies[white], h1);
+                    set_bit(occupancies[white], f1);
+                    board[h1] = -1;
+                    board[f1] = R;
                     
                     // hash rook
                     hash_key ^= piece_keys[R][h1];  // remove rook from h1 from hash key
                     hash_key ^= piece_keys[R][f1];  // put rook on f1 into a hash key
+                    
+                    // move rook in material & piece-square score
+                    move_psq_score(R, h1, f1);
+                    
+                    // move rook in NNUE accumulator
+                    add_dirty_piece(R, h1, f1);
                     break;
                 
                 // white castles queen side
@@ -2042,10 +2706,20 @@ static inline int make_move(int move, int move_flag)
                     // move A rook
                     pop_bit(bitboards[R], a1);
                     set_bit(bitboards[R], d1);
+                    pop_bit(occupancies[white], a1);
+                    set_bit(occupancies[white], d1);
+                    board[a1] = -1;
+                    board[d1] = R;
                     
                     // hash rook
                     hash_key ^= piece_keys[R][a1];  // remove rook from a1 from hash key
                     hash_key ^= piece_keys[R][d1];  // put rook on d1 into a hash key
+                    
+                    // move rook in material & piece-square score
+                    move_psq_score(R, a1, d1);
+                    
+                    // move rook in NNUE accumulator
+                    add_dirty_piece(R, a1, d1);
                     break;
                 
                 // black castles king side
@@ -2053,10 +2727,20 @@ static inline int make_move(int move, int move_flag)
                     // move H rook
                     pop_bit(bitboards[r], h8);
                     set_bit(bitboards[r], f8);
+                    pop_bit(occupancies[black], h8);
+                    set_bit(occupancies[black], f8);
+                    board[h8] = -1;
+                    board[f8] = r;
                     
                     // hash rook
                     hash_key ^= piece_keys[r][h8];  // remove rook from h8 from hash key
                     hash_key ^= piece_keys[r][f8];  // put rook on f8 into a hash key
+                    
+                    // move rook in material & piece-square score
+                    move_psq_score(r, h8, f8);
+                    
+                    // move rook in NNUE accumulator
+                    add_dirty_piece(r, h8, f8);
                     break;
                 
                 // black castles queen side
@@ -2064,10 +2748,20 @@ static inline int make_move(int move, int move_flag)
                     // move A rook
                     pop_bit(bitboards[r], a8);
                     set_bit(bitboards[r], d8);
+                    pop_bit(occupancies[black], a8);
+                    set_bit(occupancies[black], d8);
+                    board[a8] = -1;
+                    board[d8] = r;
                     
                     // hash rook
                     hash_key ^= piece_keys[r][a8];  // remove rook from a8 from hash key
                     hash_key ^= piece_keys[r][d8];  // put rook on d8 into a hash key
+                    
+                    // move rook in material & piece-square score
+                    move_psq_score(r, a8, d8);
+                    
+                    // move rook in NNUE accumulator
+                    add_dirty_piece(r, a8, d8);
                     break;
             }
         }
@@ -2082,22 +2776,8 @@ static inline int make_move(int move, int move_flag)
         // hash castling
         hash_key ^= castle_keys[castle];
         
-        // reset occupancies
-        memset(occupancies, 0ULL, 24);
-        
-        // loop over white pieces bitboards
-        for (int bb_piece = P; bb_piece <= K; bb_piece++)
-            // update white occupancies
-            occupancies[white] |= bitboards[bb_piece];
-
-        // loop over black pieces bitboards
-        for (int bb_piece = p; bb_piece <= k; bb_piece++)
-            // update black occupancies
-            occupancies[black] |= bitboards[bb_piece];
-
         // update both sides occupancies
-        occupancies[both] |= occupancies[white];
-        occupancies[both] |= occupancies[black];
+        occupancies[both] = occupancies[white] | occupancies[black];
         
         // change side
         side ^= 1;
@@ -2105,22 +2785,8 @@ static inline int make_move(int move, int move_flag)
         // hash side
         hash_key ^= side_key;
         
-        // make sure that king has not been exposed into a check
-        if (is_square_attacked((side == white) ? get_ls1b_index(bitboards[k]) : get_ls1b_index(bitboards[K]), side))
-        {
-            // take move back
-            take_back();
-            
-            // return illegal move
-            return 0;
-        }
-        
-        // otherwise
-        else
-            // return legal move
-            return 1;
-            
-            
+        // moves are legal (generated by legal move generator or verified with is_legal())
+        return 1;
     }
     
     // capture moves
@@ -2128,7 +2794,7 @@ static inline int make_move(int move, int move_flag)
     {
         // make sure move is the capture
         if (get_move_capture(move))
-            make_move(move, all_moves);
+            return make_move(move, all_moves);
         
         // otherwise the move is not a capture
         else
@@ -2137,11 +2803,248 @@ static inline int make_move(int move, int move_flag)
     }
 }
 
-// generate all moves
-static inline void generate_moves(moves *move_list)
+// make null move (pass the turn to the opponent)
+static inline void make_null_move()
+{
+    // push undo record preserving irreversible board state
+    undo *undo_info = &undo_stack[++repetition_index];
+    undo_info->move = 0;
+    undo_info->captured = -1;
+    undo_info->enpassant = enpassant;
+    undo_info->castle = castle;
+    undo_info->hash_key = hash_key;
+    
+    // hash enpassant if available
+    if (enpassant != no_sq) hash_key ^= enpassant_keys[enpassant];
+    
+    // reset enpassant capture square
+    enpassant = no_sq;
+    
+    // switch the side, literally giving opponent an extra move to make
+    side ^= 1;
+    
+    // hash the side
+    hash_key ^= side_key;
+    
+    // no pieces have moved so NNUE accumulator is the previous ply's one
+    nnue_stack[ply].accumulator.computedAccumulation = 0;
+    nnue_stack[ply].dirtyPiece.dirtyNum = 0;
+    nnue_stack[ply].dirtyPiece.pc[0] = 0;
+}
+
+// take null move back
+static inline void unmake_null_move()
+{
+    // switch the side back
+    side ^= 1;
+    
+    // restore enpassant square and hash key
+    enpassant = undo_stack[repetition_index].enpassant;
+    hash_key = undo_stack[repetition_index].hash_key;
+    
+    // pop undo record
+    repetition_index--;
+}
+
+/*
+    Legal move generation
+    
+    Checkers, check mask and pin masks are computed once per node so that
+    only legal moves are generated and make_move() doesn't have to verify
+    king safety:
+    
+    check mask    squares non king moves have to land on while in check
+                  (capture the checker or block its ray), all squares otherwise
+    HV pin mask   rank & file rays between king and enemy sliders pinning
+                  own pieces (pinners included), such pieces can only move
+                  along the ray with rook like moves
+    diagonal pin  same for diagonal rays and bishop like moves
+    
+    King moves are checked against enemy attacks with the king removed from
+    occupancy, enpassant is checked against discovered rank attacks.
+*/
+
+// legal move generation masks
+typedef struct {
+    int king_square;    // side to move king square
+    U64 checkers;       // pieces giving check
+    U64 check_mask;     // squares resolving the check
+    U64 pin_hv;         // rank & file pin rays
+    U64 pin_diagonal;   // diagonal pin rays
+} legal_masks;
+
+// init legal move generation masks for the side to move
+static inline void init_legal_masks(legal_masks *masks)
+{
+    // init king square
+    int king_square = get_ls1b_index(bitboards[(side == white) ? K : k]);
+    masks->king_square = king_square;
+    
+    // enemy sliders
+    U64 rooks_queens = (side == white) ? (bitboards[r] | bitboards[q]) : (bitboards[R] | bitboards[Q]);
+    U64 bishops_queens = (side == white) ? (bitboards[b] | bitboards[q]) : (bitboards[B] | bitboards[Q]);
+    
+    // pieces giving check
+    masks->checkers = get_attackers(king_square, side ^ 1);
+    
+    // not in check
+    if (masks->checkers == 0)
+        masks->check_mask = ~0ULL;
+    
+    // single check (capture the checker or block the ray, empty for leapers)
+    else if (count_bits(masks->checkers) == 1)
+        masks->check_mask = masks->checkers | between_masks[king_square][get_ls1b_index(masks->checkers)];
+    
+    // double check (only king can move)
+    else
+        masks->check_mask = 0ULL;
+    
+    // reset pin masks
+    masks->pin_hv = masks->pin_diagonal = 0ULL;
+    
+    // enemy sliders seeing the king through own pieces
+    U64 pinners = get_rook_attacks(king_square, occupancies[side ^ 1]) & rooks_queens;
+    
+    // loop over rank & file pinners
+    while (pinners)
+    {
+        // init pinner square
+        int pinner_square = get_ls1b_index(pinners);
+        
+        // ray between king and pinner
+        U64 ray = between_masks[king_square][pinner_square];
+        
+        // exactly one own piece on the ray is pinned
+        if (count_bits(ray & occupancies[side]) == 1)
+            masks->pin_hv |= ray | (1ULL << pinner_square);
+        
+        // pop pinner
+        pop_bit(pinners, pinner_square);
+    }
+    
+    // enemy diagonal sliders seeing the king through own pieces
+    pinners = get_bishop_attacks(king_square, occupancies[side ^ 1]) & bishops_queens;
+    
+    // loop over diagonal pinners
+    while (pinners)
+    {
+        // init pinner square
+        int pinner_square = get_ls1b_index(pinners);
+        
+        // ray between king and pinner
+        U64 ray = between_masks[king_square][pinner_square];
+        
+        // exactly one own piece on the ray is pinned
+        if (count_bits(ray & occupancies[side]) == 1)
+            masks->pin_diagonal |= ray | (1ULL << pinner_square);
+        
+        // pop pinner
+        pop_bit(pinners, pinner_square);
+    }
+}
+
+// squares a piece on the square can reach with rook like moves without exposing the king
+static inline U64 get_hv_moves_mask(legal_masks *masks, int square)
+{
+    // diagonally pinned pieces can't move along ranks & files
+    if (get_bit(masks->pin_diagonal, square)) return 0ULL;
+    
+    // rank & file pinned pieces stay on the pin ray
+    if (get_bit(masks->pin_hv, square)) return masks->pin_hv;
+    
+    // piece isn't pinned
+    return ~0ULL;
+}
+
+// squares a piece on the square can reach with bishop like moves without exposing the king
+static inline U64 get_diagonal_moves_mask(legal_masks *masks, int square)
+{
+    // rank & file pinned pieces can't move diagonally
+    if (get_bit(masks->pin_hv, square)) return 0ULL;
+    
+    // diagonally pinned pieces stay on the pin ray
+    if (get_bit(masks->pin_diagonal, square)) return masks->pin_diagonal;
+    
+    // piece isn't pinned
+    return ~0ULL;
+}
+
+// check whether enpassant capture from the source square is legal
+static inline int is_enpassant_legal(legal_masks *masks, int source_square)
+{
+    // init captured pawn square
+    int captured_square = (side == white) ? enpassant + 8 : enpassant - 8;
+    
+    // enpassant has to capture the checking pawn or block the check
+    if (!get_bit(masks->check_mask, enpassant) && !get_bit(masks->checkers, captured_square))
+        return 0;
+    
+    // occupancy after the capture (both pawns leave the rank)
+    U64 occupancy = (occupancies[both] & ~(1ULL << source_square) & ~(1ULL << captured_square)) | (1ULL << enpassant);
+    
+    // enemy sliders
+    U64 rooks_queens = (side == white) ? (bitboards[r] | bitboards[q]) : (bitboards[R] | bitboards[Q]);
+    U64 bishops_queens = (side == white) ? (bitboards[b] | bitboards[q]) : (bitboards[B] | bitboards[Q]);
+    
+    // king must not be exposed to enemy sliders
+    return !(get_rook_attacks(masks->king_square, occupancy) & rooks_queens) &&
+           !(get_bishop_attacks(masks->king_square, occupancy) & bishops_queens);
+}
+
+/*
+    Move generation types:
+    
+    generate_all         all legal moves
+    generate_captures    captures and promotions (quiescence search)
+    generate_quiets      non capturing moves except for promotions
+    generate_evasions    moves getting king out of check (same as generate_all when in check)
+*/
+
+// generate legal moves of the given type
+static inline void generate_moves(moves *move_list, int move_type)
 {
     // init move count
     move_list->count = 0;
+    
+    // init legal move generation masks
+    legal_masks masks;
+    init_legal_masks(&masks);
+    
+    // squares pieces are allowed to capture on or move quietly to
+    U64 capture_targets = occupancies[side ^ 1];
+    U64 quiet_targets = ~occupancies[both];
+    
+    // squares pawns are allowed to promote on without capturing
+    U64 promotion_targets = ~occupancies[both];
+    
+    // enpassant and castling availability
+    int enpassant_allowed = (enpassant != no_sq);
+    int castling_allowed = (masks.checkers == 0);
+    
+    // restrict move targets depending on generation type
+    switch (move_type)
+    {
+        // captures and promotions
+        case generate_captures:
+            quiet_targets = 0;
+            castling_allowed = 0;
+            break;
+        
+        // non capturing moves except for promotions
+        case generate_quiets:
+            capture_targets = 0;
+            promotion_targets = 0;
+            enpassant_allowed = 0;
+            break;
+    }
+    
+    // king is not restricted by the check mask
+    U64 king_targets = capture_targets | quiet_targets;
+    
+    // other pieces have to resolve the check
+    capture_targets &= masks.check_mask;
+    quiet_targets &= masks.check_mask;
+    promotion_targets &= masks.check_mask;
 
     // define source & target squares
     int source_square, target_square;
@@ -2170,31 +3073,39 @@ static inline void generate_moves(moves *move_list)
                     // init target square
                     target_square = source_square - 8;
                     
+                    // squares pawn can push to without exposing the king
+                    U64 push_mask = get_hv_moves_mask(&masks, source_square);
+                    
                     // generate quiet pawn moves
                     if (!(target_square < a8) && !get_bit(occupancies[both], target_square))
                     {
                         // pawn promotion
                         if (source_square >= a7 && source_square <= h7)
-                        {                            
-                            add_move(move_list, encode_move(source_square, target_square, piece, Q, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, target_square, piece, R, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, target_square, piece, B, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, target_square, piece, N, 0, 0, 0, 0));
+                        {
+                            if (get_bit(promotion_targets & push_mask, target_square))
+                            {
+                                add_move(move_list, encode_move(source_square, target_square, piece, Q, 0, 0, 0, 0));
+                                add_move(move_list, encode_move(source_square, target_square, piece, R, 0, 0, 0, 0));
+                                add_move(move_list, encode_move(source_square, target_square, piece, B, 0, 0, 0, 0));
+                                add_move(move_list, encode_move(source_square, target_square, piece, N, 0, 0, 0, 0));
+                            }
                         }
                         
                         else
                         {
                             // one square ahead pawn move
-                            add_move(move_list, encode_move(source_square, target_square, piece, 0, 0, 0, 0, 0));
+                            if (get_bit(quiet_targets & push_mask, target_square))
+                                add_move(move_list, encode_move(source_square, target_square, piece, 0, 0, 0, 0, 0));
                             
                             // two squares ahead pawn move
-                            if ((source_square >= a2 && source_square <= h2) && !get_bit(occupancies[both], target_square - 8))
+                            if ((source_square >= a2 && source_square <= h2) && !get_bit(occupancies[both], target_square - 8) &&
+                                get_bit(quiet_targets & push_mask, target_square - 8))
                                 add_move(move_list, encode_move(source_square, target_square - 8, piece, 0, 0, 1, 0, 0));
                         }
                     }
                     
                     // init pawn attacks bitboard
-                    attacks = pawn_attacks[side][source_square] & occupancies[black];
+                    attacks = pawn_attacks[side][source_square] & capture_targets & get_diagonal_moves_mask(&masks, source_square);
                     
                     // generate pawn captures
                     while (attacks)
@@ -2220,13 +3131,13 @@ static inline void generate_moves(moves *move_list)
                     }
                     
                     // generate enpassant captures
-                    if (enpassant != no_sq)
+                    if (enpassant_allowed)
                     {
                         // lookup pawn attacks and bitwise AND with enpassant square (bit)
                         U64 enpassant_attacks = pawn_attacks[side][source_square] & (1ULL << enpassant);
                         
                         // make sure enpassant capture available
-                        if (enpassant_attacks)
+                        if (enpassant_attacks && is_enpassant_legal(&masks, source_square))
                         {
                             // init enpassant capture target square
                             int target_enpassant = get_ls1b_index(enpassant_attacks);
@@ -2240,7 +3151,7 @@ static inline void generate_moves(moves *move_list)
             }
             
             // castling moves
-            if (piece == K)
+            if (piece == K && castling_allowed)
             {
                 // king side castling is available
                 if (castle & wk)
@@ -2249,7 +3160,7 @@ static inline void generate_moves(moves *move_list)
                     if (!get_bit(occupancies[both], f1) && !get_bit(occupancies[both], g1))
                     {
                         // make sure king and the f1 squares are not under attacks
-                        if (!is_square_attacked(e1, black) && !is_square_attacked(f1, black))
+                        if (!is_square_attacked(e1, black) && !is_square_attacked(f1, black) && !is_square_attacked(g1, black))
                             add_move(move_list, encode_move(e1, g1, piece, 0, 0, 0, 0, 1));
                     }
                 }
@@ -2261,7 +3172,7 @@ static inline void generate_moves(moves *move_list)
                     if (!get_bit(occupancies[both], d1) && !get_bit(occupancies[both], c1) && !get_bit(occupancies[both], b1))
                     {
                         // make sure king and the d1 squares are not under attacks
-                        if (!is_square_attacked(e1, black) && !is_square_attacked(d1, black))
+                        if (!is_square_attacked(e1, black) && !is_square_attacked(d1, black) && !is_square_attacked(c1, black))
                             add_move(move_list, encode_move(e1, c1, piece, 0, 0, 0, 0, 1));
                     }
                 }
@@ -2283,31 +3194,39 @@ static inline void generate_moves(moves *move_list)
                     // init target square
                     target_square = source_square + 8;
                     
+                    // squares pawn can push to without exposing the king
+                    U64 push_mask = get_hv_moves_mask(&masks, source_square);
+                    
                     // generate quiet pawn moves
                     if (!(target_square > h1) && !get_bit(occupancies[both], target_square))
                     {
                         // pawn promotion
                         if (source_square >= a2 && source_square <= h2)
                         {
-                            add_move(move_list, encode_move(source_square, target_square, piece, q, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, target_square, piece, r, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, target_square, piece, b, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, target_square, piece, n, 0, 0, 0, 0));
+                            if (get_bit(promotion_targets & push_mask, target_square))
+                            {
+                                add_move(move_list, encode_move(source_square, target_square, piece, q, 0, 0, 0, 0));
+                                add_move(move_list, encode_move(source_square, target_square, piece, r, 0, 0, 0, 0));
+                                add_move(move_list, encode_move(source_square, target_square, piece, b, 0, 0, 0, 0));
+                                add_move(move_list, encode_move(source_square, target_square, piece, n, 0, 0, 0, 0));
+                            }
                         }
                         
                         else
                         {
                             // one square ahead pawn move
-                            add_move(move_list, encode_move(source_square, target_square, piece, 0, 0, 0, 0, 0));
+                            if (get_bit(quiet_targets & push_mask, target_square))
+                                add_move(move_list, encode_move(source_square, target_square, piece, 0, 0, 0, 0, 0));
                             
                             // two squares ahead pawn move
-                            if ((source_square >= a7 && source_square <= h7) && !get_bit(occupancies[both], target_square + 8))
+                            if ((source_square >= a7 && source_square <= h7) && !get_bit(occupancies[both], target_square + 8) &&
+                                get_bit(quiet_targets & push_mask, target_square + 8))
                                 add_move(move_list, encode_move(source_square, target_square + 8, piece, 0, 0, 1, 0, 0));
                         }
                     }
                     
                     // init pawn attacks bitboard
-                    attacks = pawn_attacks[side][source_square] & occupancies[white];
+                    attacks = pawn_attacks[side][source_square] & capture_targets & get_diagonal_moves_mask(&masks, source_square);
                     
                     // generate pawn captures
                     while (attacks)
@@ -2333,13 +3252,13 @@ static inline void generate_moves(moves *move_list)
                     }
                     
                     // generate enpassant captures
-                    if (enpassant != no_sq)
+                    if (enpassant_allowed)
                     {
                         // lookup pawn attacks and bitwise AND with enpassant square (bit)
                         U64 enpassant_attacks = pawn_attacks[side][source_square] & (1ULL << enpassant);
                         
                         // make sure enpassant capture available
-                        if (enpassant_attacks)
+                        if (enpassant_attacks && is_enpassant_legal(&masks, source_square))
                         {
                             // init enpassant capture target square
                             int target_enpassant = get_ls1b_index(enpassant_attacks);
@@ -2353,7 +3272,7 @@ static inline void generate_moves(moves *move_list)
             }
             
             // castling moves
-            if (piece == k)
+            if (piece == k && castling_allowed)
             {
                 // king side castling is available
                 if (castle & bk)
@@ -2362,7 +3281,7 @@ static inline void generate_moves(moves *move_list)
                     if (!get_bit(occupancies[both], f8) && !get_bit(occupancies[both], g8))
                     {
                         // make sure king and the f8 squares are not under attacks
-                        if (!is_square_attacked(e8, white) && !is_square_attacked(f8, white))
+                        if (!is_square_attacked(e8, white) && !is_square_attacked(f8, white) && !is_square_attacked(g8, white))
                             add_move(move_list, encode_move(e8, g8, piece, 0, 0, 0, 0, 1));
                     }
                 }
@@ -2374,7 +3293,7 @@ static inline void generate_moves(moves *move_list)
                     if (!get_bit(occupancies[both], d8) && !get_bit(occupancies[both], c8) && !get_bit(occupancies[both], b8))
                     {
                         // make sure king and the d8 squares are not under attacks
-                        if (!is_square_attacked(e8, white) && !is_square_attacked(d8, white))
+                        if (!is_square_attacked(e8, white) && !is_square_attacked(d8, white) && !is_square_attacked(c8, white))
                             add_move(move_list, encode_move(e8, c8, piece, 0, 0, 0, 0, 1));
                     }
                 }
@@ -2391,7 +3310,8 @@ static inline void generate_moves(moves *move_list)
                 source_square = get_ls1b_index(bitboard);
                 
                 // init piece attacks in order to get set of target squares
-                attacks = knight_attacks[source_square] & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+                attacks = knight_attacks[source_square] & (capture_targets | quiet_targets) &
+                          get_hv_moves_mask(&masks, source_square) & get_diagonal_moves_mask(&masks, source_square);
                 
                 // loop over target squares available from generated attacks
                 while (attacks)
@@ -2427,7 +3347,8 @@ static inline void generate_moves(moves *move_list)
                 source_square = get_ls1b_index(bitboard);
                 
                 // init piece attacks in order to get set of target squares
-                attacks = get_bishop_attacks(source_square, occupancies[both]) & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+                attacks = get_bishop_attacks(source_square, occupancies[both]) & (capture_targets | quiet_targets) &
+                          get_diagonal_moves_mask(&masks, source_square);
                 
                 // loop over target squares available from generated attacks
                 while (attacks)
@@ -2463,7 +3384,8 @@ static inline void generate_moves(moves *move_list)
                 source_square = get_ls1b_index(bitboard);
                 
                 // init piece attacks in order to get set of target squares
-                attacks = get_rook_attacks(source_square, occupancies[both]) & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+                attacks = get_rook_attacks(source_square, occupancies[both]) & (capture_targets | quiet_targets) &
+                          get_hv_moves_mask(&masks, source_square);
                 
                 // loop over target squares available from generated attacks
                 while (attacks)
@@ -2499,7 +3421,9 @@ static inline void generate_moves(moves *move_list)
                 source_square = get_ls1b_index(bitboard);
                 
                 // init piece attacks in order to get set of target squares
-                attacks = get_queen_attacks(source_square, occupancies[both]) & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+                attacks = ((get_rook_attacks(source_square, occupancies[both]) & get_hv_moves_mask(&masks, source_square)) |
+                           (get_bishop_attacks(source_square, occupancies[both]) & get_diagonal_moves_mask(&masks, source_square))) &
+                          (capture_targets | quiet_targets);
                 
                 // loop over target squares available from generated attacks
                 while (attacks)
@@ -2535,7 +3459,24 @@ static inline void generate_moves(moves *move_list)
                 source_square = get_ls1b_index(bitboard);
                 
                 // init piece attacks in order to get set of target squares
-                attacks = king_attacks[source_square] & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+                attacks = king_attacks[source_square] & king_targets;
+                
+                // remove king from occupancy so it can't hide from sliders behind itself
+                pop_bit(occupancies[both], source_square);
+                
+                // loop over king target squares
+                for (U64 targets = attacks; targets; pop_bit(targets, target_square))
+                {
+                    // init target square
+                    target_square = get_ls1b_index(targets);
+                    
+                    // king can't step onto squares attacked by opponent
+                    if (is_square_attacked(target_square, side ^ 1))
+                        pop_bit(attacks, target_square);
+                }
+                
+                // put king back to occupancy
+                set_bit(occupancies[both], source_square);
                 
                 // loop over target squares available from generated attacks
                 while (attacks)
@@ -2562,6 +3503,224 @@ static inline void generate_moves(moves *move_list)
     }
 }
 
+// check whether move is pseudo legal in the current position
+// (pieces can make such moves regardless of king safety)
+static inline int is_pseudo_legal(int move)
+{
+    // no move
+    if (move == 0) return 0;
+    
+    // parse move
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int piece = get_move_piece(move);
+    int promoted_piece = get_move_promoted(move);
+    
+    // moving piece must belong to the side to move and stand on the source square
+    if ((side == white) ? piece > K : piece < p) return 0;
+    if (!get_bit(bitboards[piece], source_square)) return 0;
+    
+    // can't land on own pieces
+    if (get_bit(occupancies[side], target_square)) return 0;
+    
+    // target square is occupied by opponent piece
+    int capture = get_bit(occupancies[side ^ 1], target_square) ? 1 : 0;
+    
+    // castling moves
+    if (get_move_castling(move))
+    {
+        // white to move
+        if (side == white)
+        {
+            // king side castling
+            if (move == encode_move(e1, g1, K, 0, 0, 0, 0, 1))
+                return (castle & wk) && !get_bit(occupancies[both], f1) && !get_bit(occupancies[both], g1) &&
+                       !is_square_attacked(e1, black) && !is_square_attacked(f1, black) && !is_square_attacked(g1, black);
+            
+            // queen side castling
+            if (move == encode_move(e1, c1, K, 0, 0, 0, 0, 1))
+                return (castle & wq) && !get_bit(occupancies[both], d1) && !get_bit(occupancies[both], c1) &&
+                       !get_bit(occupancies[both], b1) && !is_square_attacked(e1, black) && !is_square_attacked(d1, black) && !is_square_attacked(c1, black);
+        }
+        
+        // black to move
+        else
+        {
+            // king side castling
+            if (move == encode_move(e8, g8, k, 0, 0, 0, 0, 1))
+                return (castle & bk) && !get_bit(occupancies[both], f8) && !get_bit(occupancies[both], g8) &&
+                       !is_square_attacked(e8, white) && !is_square_attacked(f8, white) && !is_square_attacked(g8, white);
+            
+            // queen side castling
+            if (move == encode_move(e8, c8, k, 0, 0, 0, 0, 1))
+                return (castle & bq) && !get_bit(occupancies[both], d8) && !get_bit(occupancies[both], c8) &&
+                       !get_bit(occupancies[both], b8) && !is_square_attacked(e8, white) && !is_square_attacked(d8, white) && !is_square_attacked(c8, white);
+        }
+        
+        // not a castling move
+        return 0;
+    }
+    
+    // pawn moves
+    if (piece == P || piece == p)
+    {
+        // pawn push direction
+        int forward = (side == white) ? -8 : 8;
+        
+        // pawn is about to promote
+        int promotion = (side == white) ? (source_square >= a7 && source_square <= h7) :
+                                          (source_square >= a2 && source_square <= h2);
+        
+        // pawn stands on its initial rank
+        int initial = (side == white) ? (source_square >= a2 && source_square <= h2) :
+                                        (source_square >= a7 && source_square <= h7);
+        
+        // promoted piece must be set on promotions only
+        if (promotion != (promoted_piece != 0)) return 0;
+        
+        // pawn can only promote to own knight, bishop, rook or queen
+        if (promoted_piece && ((side == white) ? (promoted_piece < N || promoted_piece > Q) :
+                                                 (promoted_piece < n || promoted_piece > q))) return 0;
+        
+        // enpassant capture
+        if (get_move_enpassant(move))
+            return move == encode_move(source_square, target_square, piece, 0, 1, 0, 1, 0) &&
+                   enpassant != no_sq && target_square == enpassant &&
+                   get_bit(pawn_attacks[side][source_square], target_square);
+        
+        // pawn capture
+        if (get_move_capture(move))
+            return move == encode_move(source_square, target_square, piece, promoted_piece, 1, 0, 0, 0) &&
+                   capture && get_bit(pawn_attacks[side][source_square], target_square);
+        
+        // single pawn push
+        if (target_square == source_square + forward)
+            return move == encode_move(source_square, target_square, piece, promoted_piece, 0, 0, 0, 0) &&
+                   !get_bit(occupancies[both], target_square);
+        
+        // double pawn push
+        return move == encode_move(source_square, target_square, piece, 0, 0, 1, 0, 0) &&
+               initial && target_square == source_square + 2 * forward &&
+               !get_bit(occupancies[both], source_square + forward) &&
+               !get_bit(occupancies[both], target_square);
+    }
+    
+    // pieces attacks
+    U64 attacks;
+    
+    // pick up attacks depending on piece type
+    switch ((side == white) ? piece : piece - p)
+    {
+        case N: attacks = knight_attacks[source_square]; break;
+        case B: attacks = get_bishop_attacks(source_square, occupancies[both]); break;
+        case R: attacks = get_rook_attacks(source_square, occupancies[both]); break;
+        case Q: attacks = get_queen_attacks(source_square, occupancies[both]); break;
+        default: attacks = king_attacks[source_square]; break;
+    }
+    
+    // piece must attack target square and capture flag must match target square
+    return move == encode_move(source_square, target_square, piece, 0, capture, 0, 0, 0) &&
+           get_bit(attacks, target_square);
+}
+
+// check whether move would be generated by generate_moves() in the current position
+// (used to validate moves coming from hash table, PV and killers)
+static inline int is_legal(int move)
+{
+    // move must be pseudo legal
+    if (!is_pseudo_legal(move)) return 0;
+    
+    // init legal move generation masks
+    legal_masks masks;
+    init_legal_masks(&masks);
+    
+    // parse move
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int piece = get_move_piece(move);
+    
+    // king moves
+    if (piece == K || piece == k)
+    {
+        // castling squares have been checked by is_pseudo_legal()
+        if (get_move_castling(move)) return 1;
+        
+        // remove king from occupancy so it can't hide from sliders behind itself
+        pop_bit(occupancies[both], source_square);
+        
+        // king can't step onto squares attacked by opponent
+        int attacked = is_square_attacked(target_square, side ^ 1);
+        
+        // put king back to occupancy
+        set_bit(occupancies[both], source_square);
+        
+        return !attacked;
+    }
+    
+    // enpassant captures
+    if (get_move_enpassant(move))
+        return is_enpassant_legal(&masks, source_square);
+    
+    // move has to resolve the check
+    if (!get_bit(masks.check_mask, target_square)) return 0;
+    
+    // pinned pieces have to stay on the pin ray
+    if (get_bit(masks.pin_hv | masks.pin_diagonal, source_square))
+        return get_bit(between_masks[masks.king_square][target_square], source_square) ||
+               get_bit(between_masks[masks.king_square][source_square], target_square);
+    
+    // legal move
+    return 1;
+}
+
+
+// board state structure
+typedef struct {
+    U64 bitboards[12];
+    U64 occupancies[3];
+    int board[64];
+    int side, enpassant, castle;
+    U64 hash_key, pawn_key, material_key;
+    int psq_score[2], phase_score;
+    undo undo_stack[1000];
+    int repetition_index;
+} position;
+
+// store current thread's board state
+void save_position(position *pos)
+{
+    memcpy(pos->bitboards, bitboards, sizeof(bitboards));
+    memcpy(pos->occupancies, occupancies, sizeof(occupancies));
+    memcpy(pos->board, board, sizeof(board));
+    pos->side = side, pos->enpassant = enpassant, pos->castle = castle;
+    pos->hash_key = hash_key;
+    pos->pawn_key = pawn_key;
+    pos->material_key = material_key;
+    memcpy(pos->psq_score, psq_score, sizeof(psq_score));
+    pos->phase_score = phase_score;
+    memcpy(pos->undo_stack, undo_stack, sizeof(undo_stack));
+    pos->repetition_index = repetition_index;
+}
+
+// restore board state into current thread
+void load_position(position *pos)
+{
+    memcpy(bitboards, pos->bitboards, sizeof(bitboards));
+    memcpy(occupancies, pos->occupancies, sizeof(occupancies));
+    memcpy(board, pos->board, sizeof(board));
+    side = pos->side, enpassant = pos->enpassant, castle = pos->castle;
+    hash_key = pos->hash_key;
+    pawn_key = pos->pawn_key;
+    material_key = pos->material_key;
+    memcpy(psq_score, pos->psq_score, sizeof(psq_score));
+    phase_score = pos->phase_score;
+    memcpy(undo_stack, pos->undo_stack, sizeof(undo_stack));
+    repetition_index = pos->repetition_index;
+    
+    // NNUE accumulator has to be refreshed
+    nnue_stack[0].accumulator.computedAccumulation = 0;
+}
+
 
 /**********************************\
  ==================================
@@ -2572,92 +3731,215 @@ static inline void generate_moves(moves *move_list)
 \**********************************/
 
 // leaf nodes (number of positions reached during the test of the move generator at a given depth)
-U64 nodes;
+_Thread_local U64 nodes;
+
+// perft hash table entry
+typedef struct {
+    U64 hash_lock;  // position hash key XORed with data
+    U64 data;       // leaf nodes count (upper 56 bits) and depth (lower 8 bits)
+} perft_entry;
+
+// perft hash table
+perft_entry *perft_table = NULL;
+
+// perft hash table index mask
+U64 perft_mask = 0;
 
 // perft driver
-static inline void perft_driver(int depth)
+static inline U64 perft_driver(int depth)
 {
     // reccursion escape condition
     if (depth == 0)
-    {
-        // increment nodes count (count reached positions)
-        nodes++;
-        return;
-    }
+        // count reached position
+        return 1;
     
     // create move list instance
     moves move_list[1];
     
     // generate moves
-    generate_moves(move_list);
+    generate_moves(move_list, generate_all);
+    
+    // moves are legal, so count them without making at the last ply (bulk counting)
+    if (depth == 1)
+        return move_list->count;
     
-        // loop over generated moves
+    // probe perft hash table
+    perft_entry *entry = &perft_table[hash_key & perft_mask];
+    U64 data = entry->data;
+    
+    // same position searched to the same depth before
+    if ((entry->hash_lock ^ data) == hash_key && (int)(data & 0xff) == depth)
+        // return stored leaf nodes count
+        return data >> 8;
+    
+    // leaf nodes count
+    U64 count = 0;
+    
+    // loop over generated moves
     for (int move_count = 0; move_count < move_list->count; move_count++)
     {   
-        // preserve board state
-        copy_board();
-        
         // make move
         if (!make_move(move_list->moves[move_count], all_moves))
             // skip to the next move
             continue;
         
         // call perft driver recursively
-        perft_driver(depth - 1);
+        count += perft_driver(depth - 1);
         
         // take back
-        take_back();        
+        unmake_move();
     }
+    
+    // store leaf nodes count (XOR trick keeps torn writes from other threads harmless)
+    data = (count << 8) | depth;
+    entry->hash_lock = hash_key ^ data;
+    entry->data = data;
+    
+    // return leaf nodes count
+    return count;
 }
 
-// perft test
-void perft_test(int depth)
+// perft thread data
+typedef struct {
+    int id;             // thread index
+    pthread_t handle;   // thread handle
+} perft_thread;
+
+// position to run perft from
+position perft_root;
+
+// root moves (split across perft threads)
+moves perft_root_moves[1];
+
+// leaf nodes count of every root move
+U64 perft_root_nodes[256];
+
+// perft depth
+int perft_depth;
+
+// index of the next root move to pick by a perft thread
+int perft_next_move;
+
+// count leaf nodes of root moves until there are none left
+void *perft_worker(void *arg)
 {
-    printf("\n     Performance test\n\n");
-    
-    // create move list instance
-    moves move_list[1];
-    
-    // generate moves
-    generate_moves(move_list);
+    // init thread index
+    thread_id = ((perft_thread *)arg)->id;
     
-    // init start time
-    long start = get_time_ms();
+    // init thread's board from the root position
+    load_position(&perft_root);
     
-    // loop over generated moves
-    for (int move_count = 0; move_count < move_list->count; move_count++)
-    {   
-        // preserve board state
-        copy_board();
-        
-        // make move
-        if (!make_move(move_list->moves[move_count], all_moves))
-            // skip to the next move
-            continue;
+    // loop over root moves
+    while (1)
+    {
+        // pick the next root move
+        int move_count = __sync_fetch_and_add(&perft_next_move, 1);
         
-        // cummulative nodes
-        long cummulative_nodes = nodes;
+        // no root moves left
+        if (move_count >= perft_root_moves->count) break;
         
-        // call perft driver recursively
-        perft_driver(depth - 1);
+        // make move
+        make_move(perft_root_moves->moves[move_count], all_moves);
         
-        // old nodes
-        long old_nodes = nodes - cummulative_nodes;
+        // count leaf nodes
+        perft_root_nodes[move_count] = perft_driver(perft_depth - 1);
         
         // take back
-        take_back();
+        unmake_move();
+    }
+    
+    return NULL;
+}
+
+// perft test (optionally print leaf nodes count of every root move)
+void perft_test(int depth, int divide, int thread_count, int hash_mb)
+{
+    printf("\n     Performance test\n\n");
+    
+    // perft starts at depth 1
+    if (depth < 1) depth = 1;
+    
+    // at least one thread does the work
+    if (thread_count < 1) thread_count = 1;
+    
+    // init number of hash entries (round down to the power of 2)
+    U64 entries = 1;
+    while (entries * 2 * sizeof(perft_entry) <= 0x100000ULL * hash_mb) entries *= 2;
+    
+    // allocate and clear perft hash table
+    perft_table = (perft_entry *) calloc(entries, sizeof(perft_entry));
+    perft_mask = entries - 1;
+    
+    // if allocation has failed
+    if (perft_table == NULL)
+    {
+        // fall back to a single entry table
+        perft_table = (perft_entry *) calloc(1, sizeof(perft_entry));
+        perft_mask = 0;
+    }
+    
+    // init root position and moves
+    save_position(&perft_root);
+    generate_moves(perft_root_moves, generate_all);
+    perft_depth = depth;
+    perft_next_move = 0;
+    
+    // perft threads
+    perft_thread *workers = (perft_thread *) malloc(thread_count * sizeof(perft_thread));
+    
+    // init start time
+    long start = get_time_ms();
+    
+    // start helper perft threads
+    for (int id = 1; id < thread_count; id++)
+    {
+        workers[id].id = id;
+        pthread_create(&workers[id].handle, NULL, perft_worker, &workers[id]);
+    }
+    
+    // main thread counts leaf nodes as well
+    workers[0].id = 0;
+    perft_worker(&workers[0]);
+    
+    // wait for helper perft threads to finish
+    for (int id = 1; id < thread_count; id++)
+        pthread_join(workers[id].handle, NULL);
+    
+    // init elapsed time (avoid division by zero)
+    long elapsed = get_time_ms() - start;
+    if (elapsed < 1) elapsed = 1;
+    
+    // restore main thread's board (root moves have been made on it)
+    load_position(&perft_root);
+    
+    // total leaf nodes
+    U64 total = 0;
+    
+    // loop over root moves
+    for (int move_count = 0; move_count < perft_root_moves->count; move_count++)
+    {
+        // sum up leaf nodes
+        total += perft_root_nodes[move_count];
         
         // print move
-        printf("     move: %s%s%c  nodes: %ld\n", square_to_coordinates[get_move_source(move_list->moves[move_count])],
-                                                  square_to_coordinates[get_move_target(move_list->moves[move_count])],
-                                                  get_move_promoted(move_list->moves[move_count]) ? promoted_pieces[get_move_promoted(move_list->moves[move_count])] : ' ',
-                                                  old_nodes);
+        if (divide)
+            printf("     move: %s%s%c  nodes: %llu\n", square_to_coordinates[get_move_source(perft_root_moves->moves[move_count])],
+                                                      square_to_coordinates[get_move_target(perft_root_moves->moves[move_count])],
+                                                      get_move_promoted(perft_root_moves->moves[move_count]) ? promoted_pieces[get_move_promoted(perft_root_moves->moves[move_count])] : ' ',
+                                                      perft_root_nodes[move_count]);
     }
     
     // print results
     printf("\n    Depth: %d\n", depth);
-    printf("    Nodes: %lld\n", nodes);
-    printf("     Time: %ld\n\n", get_time_ms() - start);
+    printf("    Nodes: %llu\n", total);
+    printf("     Time: %ld\n", elapsed);
+    printf("      NPS: %llu\n", total * 1000 / elapsed);
+    printf("  Sliders: %s\n\n", slider_backends[slider_backend]);
+    
+    // free perft threads and hash table
+    free(workers);
+    free(perft_table);
+    perft_table = NULL;
 }
 
 
@@ -2669,21 +3951,6 @@ void perft_test(int depth)
  ==================================
 \**********************************/
 
-// convert BBC piece code to Stockfish piece codes
-int nnue_pieces[12] = { 6, 5, 4, 3, 2, 1, 12, 11, 10, 9, 8, 7 };
-
-// convert BBC square indicies to Stockfish indicies
-int nnue_squares[64] = {
-    a1, b1, c1, d1, e1, f1, g1, h1,
-	a2, b2, c2, d2, e2, f2, g2, h2,
-	a3, b3, c3, d3, e3, f3, g3, h3,
-	a4, b4, c4, d4, e4, f4, g4, h4,
-	a5, b5, c5, d5, e5, f5, g5, h5,
-	a6, b6, c6, d6, e6, f6, g6, h6,
-	a7, b7, c7, d7, e7, f7, g7, h7,
-	a8, b8, c8, d8, e8, f8, g8, h8
-};
-
 // material scrore
 
 /*
@@ -2873,6 +4140,8 @@ const int mirror_score[128] =
        a b c d e f g h       a b c d e f g h       a b c d e f g h        a b c d e f g h 
 */
 
+#ifndef PRECOMPUTED_TABLES
+
 // file masks [square]
 U64 file_masks[64];
 
@@ -2888,6 +4157,8 @@ U64 white_passed_masks[64];
 // black passed pawn masks [square]
 U64 black_passed_masks[64];
 
+#endif
+
 // extract rank from a square [square]
 const int get_rank[64] =
 {
@@ -2931,6 +4202,42 @@ static const int queen_mobility_endgame = 2;
 // king's shield bonus
 const int king_shield_bonus = 5;
 
+// bishop pair bonus
+const int bishop_pair_opening = 30;
+const int bishop_pair_endgame = 50;
+
+// score of a won endgame (well below mate scores)
+const int known_win_score = 10000;
+
+// init material & piece-square score and game phase score tables
+void init_psq_table()
+{
+    // loop over pieces
+    for (int piece = P; piece <= k; piece++)
+        // knights, bishops, rooks & queens count towards game phase score
+        phase_table[piece] = (piece % 6 >= N && piece % 6 <= Q) ? abs(material_score[opening][piece]) : 0;
+    
+    // loop over game phases
+    for (int phase = opening; phase <= endgame; phase++)
+    {
+        // loop over board squares
+        for (int square = 0; square < 64; square++)
+        {
+            // loop over piece types
+            for (int piece = P; piece <= K; piece++)
+            {
+                // white piece score
+                psq_table[phase][piece][square] = material_score[phase][piece] + positional_score[phase][piece][square];
+                
+                // black piece score (mirrored)
+                psq_table[phase][piece + 6][square] = material_score[phase][piece + 6] - positional_score[phase][piece][mirror_score[square]];
+            }
+        }
+    }
+}
+
+#ifndef PRECOMPUTED_TABLES
+
 // set file or rank mask
 U64 set_file_rank_mask(int file_number, int rank_number)
 {
@@ -3067,6 +4374,8 @@ void init_evaluation_masks()
     }
 }
 
+#endif
+
 // get game phase score
 static inline int get_game_phase_score()
 {
@@ -3079,58 +4388,21 @@ static inline int get_game_phase_score()
         4 * bishop material score in the opening +
         4 * rook material score in the opening +
         2 * queen material score in the opening
+        
+        It's kept up to date by make/unmake move (see move_psq_score())
     */
     
-    // white & black game phase scores
-    int white_piece_scores = 0, black_piece_scores = 0;
-    
-    // loop over white pieces
-    for (int piece = N; piece <= Q; piece++)
-        white_piece_scores += count_bits(bitboards[piece]) * material_score[opening][piece];
-    
-    // loop over white pieces
-    for (int piece = n; piece <= q; piece++)
-        black_piece_scores += count_bits(bitboards[piece]) * -material_score[opening][piece];
-    
     // return game phase score
-    return white_piece_scores + black_piece_scores;
+    return phase_score;
 }
 
-// position evaluation
-static inline int evaluate()
-{   
-    // get game phase score
-    int game_phase_score = get_game_phase_score();
-    
-    // game phase (opening, middle game, endgame)
-    int game_phase = -1;
-    
-    // pick up game phase based on game phase score
-    if (game_phase_score > opening_phase_score) game_phase = opening;
-    else if (game_phase_score < endgame_phase_score) game_phase = endgame;
-    else game_phase = middlegame;
-    
-    // static evaluation score
-    int score = 0, score_opening = 0, score_endgame = 0;
-    
-    // current pieces bitboard copy
+// init NNUE input
+static inline void nnue_input(int *pieces, int *squares)
+{
     U64 bitboard;
-    
-    // init piece & square
     int piece, square;
-    
-    // penalties
-    int double_pawns = 0;
-    
-    // array of piece codes converted to Stockfish piece codes
-    int pieces[33];
-    
-    // array of square indices converted to Stockfish square indices
-    int squares[33];
-    
-    // pieces and squares current index to write next piece square pair at
     int index = 2;
-    
+
     // loop over piece bitboards
     for (int bb_piece = P; bb_piece <= k; bb_piece++)
     {
@@ -3146,146 +4418,710 @@ static inline int evaluate()
             // init square
             square = get_ls1b_index(bitboard);
             
-            // in opening and middlegame use NNUE evaluation
-            if (game_phase != endgame)
+            //printf("piece: %c  piece code: %d  square index: %d  square: %s\n", ascii_pieces[piece], piece, square, square_to_coordinates[square]);
+            
+            if (piece == K)
             {
-                /*
-                    Code to initialize pieces and squares arrays
-                    to serve the purpose of direct probing of NNUE
-                */
-                
-                // case white king
-                if (piece == K)
-                {
-                    /* convert white king piece code to stockfish piece code and
-                       store it at the first index of pieces array
-                    */ 
-                    pieces[0] = nnue_pieces[piece];
-                    
-                    /* convert white king square index to stockfish square index and
-                       store it at the first index of pieces array
-                    */
-                    squares[0] = nnue_squares[square];
-                }
+                /* convert white king piece code to stockfish piece code and
+                   store it at the first index of pieces array
+                */ 
+                pieces[0] = nnue_pieces[piece];
                 
-                // case black king
-                else if (piece == k)
-                {
-                    /* convert black king piece code to stockfish piece code and
-                       store it at the second index of pieces array
-                    */
-                    pieces[1] = nnue_pieces[piece];
-                    
-                    /* convert black king square index to stockfish square index and
-                       store it at the second index of pieces array
-                    */
-                    squares[1] = nnue_squares[square];
-                }
+                /* convert white king square index to stockfish square index and
+                   store it at the first index of pieces array
+                */
+                squares[0] = nnue_squares[square];
+            }
+            
+            else if (piece == k)
+            {
+                /* convert black king piece code to stockfish piece code and
+                   store it at the second index of pieces array
+                */
+                pieces[1] = nnue_pieces[piece];
                 
-                // all the rest pieces
-                else
-                {
-                    /*  convert all the rest of piece code with corresponding square codes
-                        to stockfish piece codes and square indicies respectively
-                    */
-                    pieces[index] = nnue_pieces[piece];
-                    squares[index] = nnue_squares[square];
-                    index++;    
-                }
+                /* convert black king square index to stockfish square index and
+                   store it at the second index of pieces array
+                */
+                squares[1] = nnue_squares[square];
             }
             
-            // in the endgame use handcrafted evaluation to speed up engine
             else
             {
-                // get opening/endgame material score
-                score_opening += material_score[opening][piece];
-                score_endgame += material_score[endgame][piece];
+                /*  convert all the rest of piece code with corresponding square codes
+                    to stockfish piece codes and square indicies respectively
+                */
+                pieces[index] = nnue_pieces[piece];
+                squares[index] = nnue_squares[square];
+                index++;    
+            }
+            
+            // pop LS1B
+            pop_bit(bitboard, square);
+        }
+    }
+    
+    // end arrays with sero terminating character
+    pieces[index] = 0;
+    squares[index] = 0;
+}
 
-                // score positional piece scores
-                switch (piece)
-                {
-                    // evaluate white pawns
-                    case P:
-                        // get opening/endgame positional score
-                        score_opening += positional_score[opening][PAWN][square];
-                        score_endgame += positional_score[endgame][PAWN][square];
-
-                        // double pawn penalty
-                        double_pawns = count_bits(bitboards[P] & file_masks[square]);
-                        
-                        // on double pawns (tripple, etc)
-                        if (double_pawns > 1)
-                        {
-                            score_opening += (double_pawns - 1) * double_pawn_penalty_opening;
-                            score_endgame += (double_pawns - 1) * double_pawn_penalty_endgame;
-                        }
-                        
-                        // on isolated pawn
-                        if ((bitboards[P] & isolated_masks[square]) == 0)
-                        {
-                            // give an isolated pawn penalty
-                            score_opening += isolated_pawn_penalty_opening;
-                            score_endgame += isolated_pawn_penalty_endgame;
-                        }
-                        // on passed pawn
-                        if ((white_passed_masks[square] & bitboards[p]) == 0)
-                        {
-                            // give passed pawn bonus
-                            score_opening += passed_pawn_bonus[get_rank[square]];
-                            score_endgame += passed_pawn_bonus[get_rank[square]];
-                        }
-                        
-                        break;
-                    
-                    // evaluate white knights
-                    case N:
-                        // get opening/endgame positional score
-                        score_opening += positional_score[opening][KNIGHT][square];
-                        score_endgame += positional_score[endgame][KNIGHT][square];
-                        
-                        break;
-                    
-                    // evaluate white bishops
-                    case B:
-                        // get opening/endgame positional score
-                        score_opening += positional_score[opening][BISHOP][square];
-                        score_endgame += positional_score[endgame][BISHOP][square];
-                        
-                        // mobility
-                        score_opening += (count_bits(get_bishop_attacks(square, occupancies[both])) - bishop_unit) * bishop_mobility_opening;
-                        score_endgame += (count_bits(get_bishop_attacks(square, occupancies[both])) - bishop_unit) * bishop_mobility_endgame;                    
-                        break;
-                    
-                    // evaluate white rooks
-                    case R:
-                        // get opening/endgame positional score
-                        score_opening += positional_score[opening][ROOK][square];
-                        score_endgame += positional_score[endgame][ROOK][square];
-                        
-                        // semi open file
-                        if ((bitboards[P] & file_masks[square]) == 0)
-                        {
-                            // add semi open file bonus
-                            score_opening += semi_open_file_score;
-                            score_endgame += semi_open_file_score;
-                        }
-                        
-                        // semi open file
-                        if (((bitboards[P] | bitboards[p]) & file_masks[square]) == 0)
-                        {
-                            // add semi open file bonus
-                            score_opening += open_file_score;
-                            score_endgame += open_file_score;
-                        }
-                        
-                        break;
+// NNUE data of the current and two previous plies
+#define nnue_data()                                                       \
+    NNUEdata *nnue[3] = {                                                 \
+        &nnue_stack[ply],                                                 \
+        ply > 0 ? &nnue_stack[ply - 1] : NULL,                            \
+        ply > 1 ? &nnue_stack[ply - 2] : NULL                             \
+    };                                                                    \
+
+// NNUE networks
+enum { main_net, endgame_net };
+
+// NNUE network files (UCI "EvalFile" & "EndgameEvalFile" options, empty = not used)
+char nnue_files[2][256] = { nnue_file, "" };
+
+// network is loaded
+int nnue_loaded[2];
+
+// game phase score below which endgame network is used (UCI "EndgameNetPhase" option)
+int endgame_net_phase = 3500;
+
+// network the current thread evaluates with
+_Thread_local int selected_net = main_net;
+
+// (re)load NNUE networks from the files set
+void load_nnue_networks()
+{
+    // loop over networks
+    for (int net = main_net; net <= endgame_net; net++)
+        // load network if the file is set
+        nnue_loaded[net] = nnue_files[net][0] ? load_nnue(net, nnue_files[net]) : 0;
+}
+
+// print NNUE networks in use
+void print_nnue_networks()
+{
+    // no network is loaded
+    if (!nnue_loaded[main_net] && !nnue_loaded[endgame_net])
+        printf("info string no NNUE network loaded, using handcrafted evaluation\n");
+    
+    // both networks are loaded
+    else if (nnue_loaded[main_net] && nnue_loaded[endgame_net])
+        printf("info string NNUE %s, endgame (phase < %d) %s\n", nnue_files[main_net], endgame_net_phase, nnue_files[endgame_net]);
+    
+    // one network is used in all phases
+    else
+        printf("info string NNUE %s in all phases\n", nnue_files[nnue_loaded[main_net] ? main_net : endgame_net]);
+}
+
+// pick NNUE network for the given game phase score (-1 if no network is loaded)
+static inline int get_nnue_net(int game_phase_score)
+{
+    // simple positions use endgame network if there's one
+    if (nnue_loaded[endgame_net] && game_phase_score < endgame_net_phase) return endgame_net;
+    
+    // otherwise any network loaded
+    if (nnue_loaded[main_net]) return main_net;
+    if (nnue_loaded[endgame_net]) return endgame_net;
+    
+    // handcrafted evaluation is used
+    return -1;
+}
+
+// make the current thread evaluate with the given network
+static inline void use_nnue_net(int net)
+{
+    // network has changed
+    if (net != selected_net)
+    {
+        // select network in NNUE lib
+        select_nnue(net);
+        selected_net = net;
+    }
+}
+
+// compute NNUE accumulator of the current ply so that child nodes could update it incrementally
+static inline void update_nnue_accumulator()
+{
+    // accumulator is already up to date
+    if (nnue_stack[ply].accumulator.computedAccumulation) return;
+    
+    // pick up NNUE network
+    int net = get_nnue_net(get_game_phase_score());
+    
+    // no network, handcrafted evaluation is used
+    if (net < 0) return;
+    
+    // evaluate with the picked network
+    use_nnue_net(net);
+    
+    // pieces & squares arrays
+    int pieces[33];
+    int squares[33];
+    
+    // init NNUE input
+    nnue_input(pieces, squares);
+    
+    // NNUE data of the current and two previous plies
+    nnue_data();
+    
+    // update accumulator from the previous ply's one or refresh it
+    update_accumulator_nnue(pieces, squares, nnue);
+}
+
+// number of evaluation cache entries per thread (power of 2)
+#define eval_cache_size 16384
+
+// evaluation cache entry
+typedef struct {
+    U64 hash_key;   // position the score belongs to (side to move is hashed in)
+    int score;      // static evaluation score
+} eval_cache_entry;
+
+// evaluation cache (small, lossy, per thread)
+_Thread_local eval_cache_entry eval_cache[eval_cache_size];
+
+// evaluation cache counters of the current search
+_Thread_local U64 eval_cache_probes, eval_cache_hits;
+
+// clear evaluation cache of the current thread
+void clear_eval_cache()
+{
+    memset(eval_cache, 0, sizeof(eval_cache));
+}
+
+// number of pawn hash table entries (power of 2)
+#define pawn_table_size 16384
+
+// pawn hash table entry
+typedef struct {
+    U64 pawn_key;       // pawn structure the entry belongs to
+    int score_opening;  // pawn structure score in the opening (from white's point of view)
+    int score_endgame;  // pawn structure score in the endgame (from white's point of view)
+    U64 passed[2];      // passed pawns [side]
+} pawn_entry;
+
+// pawn hash table (per thread, entries are never stale as pawn scores depend on pawns only)
+_Thread_local pawn_entry pawn_table[pawn_table_size];
+
+// evaluate doubled, isolated & passed pawns (cached in pawn hash table)
+static inline pawn_entry *evaluate_pawns()
+{
+    // pawn hash table entry of the current pawn structure
+    pawn_entry *entry = &pawn_table[pawn_key & (pawn_table_size - 1)];
+    
+    // pawn structure has been evaluated before (empty entries match positions without pawns)
+    if (entry->pawn_key == pawn_key) return entry;
+    
+    // init entry
+    entry->pawn_key = pawn_key;
+    entry->score_opening = entry->score_endgame = 0;
+    entry->passed[white] = entry->passed[black] = 0ULL;
+    
+    // loop over pawn bitboards
+    for (int piece = P; piece <= p; piece += p - P)
+    {
+        // init pawn bitboard copy
+        U64 bitboard = bitboards[piece];
+        
+        // score sign of the side
+        int sign = (piece == P) ? 1 : -1;
+        
+        // loop over pawns within a bitboard
+        while (bitboard)
+        {
+            // init square
+            int square = get_ls1b_index(bitboard);
+            
+            // double pawn penalty
+            int double_pawns = count_bits(bitboards[piece] & file_masks[square]);
+            
+            // on double pawns (tripple, etc)
+            if (double_pawns > 1)
+            {
+                entry->score_opening += sign * (double_pawns - 1) * double_pawn_penalty_opening;
+                entry->score_endgame += sign * (double_pawns - 1) * double_pawn_penalty_endgame;
+            }
+            
+            // on isolated pawn
+            if ((bitboards[piece] & isolated_masks[square]) == 0)
+            {
+                // give an isolated pawn penalty
+                entry->score_opening += sign * isolated_pawn_penalty_opening;
+                entry->score_endgame += sign * isolated_pawn_penalty_endgame;
+            }
+            
+            // on passed pawn
+            if (((piece == P ? white_passed_masks[square] : black_passed_masks[square]) & bitboards[piece == P ? p : P]) == 0)
+            {
+                // give passed pawn bonus
+                entry->score_opening += sign * passed_pawn_bonus[get_rank[square]];
+                entry->score_endgame += sign * passed_pawn_bonus[get_rank[square]];
+                
+                // store passed pawn
+                set_bit(entry->passed[piece == P ? white : black], square);
+            }
+            
+            // pop ls1b
+            pop_bit(bitboard, square);
+        }
+    }
+    
+    // return evaluated entry
+    return entry;
+}
+
+/*
+    Specialised endgame evaluators score positions from the side to move
+    point of view given the side having the upper hand (strong side)
+*/
+
+// distance in king moves between two squares
+static inline int square_distance(int square_1, int square_2)
+{
+    int file_distance = abs((square_1 & 7) - (square_2 & 7));
+    int rank_distance = abs((square_1 >> 3) - (square_2 >> 3));
+    
+    return file_distance > rank_distance ? file_distance : rank_distance;
+}
+
+// bonus for driving the king to the edge of the board (0 in the center, 120 in the corner)
+static inline int push_to_edge(int square)
+{
+    int file = square & 7, rank = square >> 3;
+    
+    // distance to the closest edge for file & rank
+    int file_edge = file < 4 ? file : 7 - file;
+    int rank_edge = rank < 4 ? rank : 7 - rank;
+    
+    return 20 * (6 - file_edge - rank_edge);
+}
+
+// bonus for bringing kings close to each other
+static inline int push_close(int square_1, int square_2)
+{
+    return 140 - 20 * square_distance(square_1, square_2);
+}
+
+// material can't mate at all (KK, KmK): search is cut off as well
+static int evaluate_insufficient(int strong_side)
+{
+    (void)strong_side;
+    return 0;
+}
+
+// material can't force a win but helpmates exist (KmKm, KNNK with no pawns): scored only, searched as usual
+static int evaluate_draw(int strong_side)
+{
+    (void)strong_side;
+    return 0;
+}
+
+// rook or queen (and anything else) against bare king: drive the king to the edge
+static int evaluate_kxk(int strong_side)
+{
+    // init king squares
+    int strong_king = get_ls1b_index(bitboards[strong_side == white ? K : k]);
+    int weak_king = get_ls1b_index(bitboards[strong_side == white ? k : K]);
+    
+    // material advantage of the strong side
+    int material = strong_side == white ? psq_score[endgame] : -psq_score[endgame];
+    
+    // won position score
+    int score = known_win_score + material + push_to_edge(weak_king) + push_close(strong_king, weak_king);
+    
+    // return score based on side
+    return side == strong_side ? score : -score;
+}
+
+// bishop & knight against bare king: drive the king to a corner of bishop's color
+static int evaluate_kbnk(int strong_side)
+{
+    // init king & bishop squares
+    int strong_king = get_ls1b_index(bitboards[strong_side == white ? K : k]);
+    int weak_king = get_ls1b_index(bitboards[strong_side == white ? k : K]);
+    int bishop = get_ls1b_index(bitboards[strong_side == white ? B : b]);
+    
+    // corners of bishop's color (a8 & h1 are light, a1 & h8 are dark)
+    int light_bishop = ((bishop & 7) + (bishop >> 3)) % 2 == 0;
+    int corner_1 = light_bishop ? a8 : a1;
+    int corner_2 = light_bishop ? h1 : h8;
+    
+    // distance to the closest mating corner
+    int corner_distance = square_distance(weak_king, corner_1) < square_distance(weak_king, corner_2) ?
+                          square_distance(weak_king, corner_1) : square_distance(weak_king, corner_2);
+    
+    // won position score
+    int score = known_win_score + push_close(strong_king, weak_king) + 40 * (7 - corner_distance);
+    
+    // return score based on side
+    return side == strong_side ? score : -score;
+}
+
+// rook against pawn (rules from Stockfish's KRKP evaluator)
+static int evaluate_krkp(int strong_side)
+{
+    // init squares flipped so that the strong side is white (the pawn runs down to the 1st rank)
+    int flip = strong_side == white ? 0 : 56;
+    int strong_king = get_ls1b_index(bitboards[strong_side == white ? K : k]) ^ flip;
+    int weak_king = get_ls1b_index(bitboards[strong_side == white ? k : K]) ^ flip;
+    int rook = get_ls1b_index(bitboards[strong_side == white ? R : r]) ^ flip;
+    int pawn = get_ls1b_index(bitboards[strong_side == white ? p : P]) ^ flip;
+    
+    // pawn promotion square and the square in front of the pawn
+    int queening_square = 56 + (pawn & 7);
+    int push_square = pawn + 8;
+    
+    // rook endgame value
+    int rook_value = material_score[endgame][R];
+    
+    // init score
+    int score;
+    
+    // strong king is in front of the pawn: win
+    if ((strong_king & 7) == (pawn & 7) && strong_king > pawn)
+        score = rook_value - square_distance(strong_king, pawn);
+    
+    // weak king is too far from the pawn and the rook: win
+    else if (square_distance(weak_king, pawn) >= 3 + (side != strong_side) &&
+             square_distance(weak_king, rook) >= 3)
+        score = rook_value - square_distance(strong_king, pawn);
+    
+    // pawn is far advanced and supported by the weak king while strong king is away: drawish
+    else if ((weak_king >> 3) >= 5 && square_distance(weak_king, pawn) == 1 &&
+             (strong_king >> 3) <= 4 && square_distance(strong_king, pawn) > 2 + (side == strong_side))
+        score = 80 - 8 * square_distance(strong_king, pawn);
+    
+    // otherwise kings race for the square in front of the pawn
+    else
+        score = 200 - 8 * (square_distance(strong_king, push_square) -
+                           square_distance(weak_king, push_square) -
+                           square_distance(pawn, queening_square));
+    
+    // return score based on side
+    return side == strong_side ? score : -score;
+}
+
+// number of material hash table entries (power of 2)
+#define material_table_size 8192
+
+// material hash table entry
+typedef struct {
+    U64 material_key;               // material signature the entry belongs to
+    int phase;                      // game phase score
+    int imbalance[2];               // material imbalance score [game phase] from white's point of view
+    int (*evaluate)(int);           // specialised endgame evaluator (NULL if none)
+    int strong_side;                // side the evaluator is called for
+} material_entry;
+
+// material hash table (per thread, entries depend on piece counts only)
+_Thread_local material_entry material_table[material_table_size];
+
+// look up material signature of the current position (analysing it on a miss)
+static inline material_entry *probe_material()
+{
+    // material hash table entry of the current material signature
+    material_entry *entry = &material_table[material_key & (material_table_size - 1)];
+    
+    // material signature has been analysed before
+    if (entry->material_key == material_key) return entry;
+    
+    // init entry
+    entry->material_key = material_key;
+    entry->phase = get_game_phase_score();
+    entry->evaluate = NULL;
+    entry->strong_side = white;
+    
+    // piece counts [side][piece type]
+    int count[2][6];
+    
+    // loop over piece types
+    for (int piece = P; piece <= K; piece++)
+    {
+        count[white][piece] = count_bits(bitboards[piece]);
+        count[black][piece] = count_bits(bitboards[piece + 6]);
+    }
+    
+    // bishop pair imbalance
+    int bishop_pairs = (count[white][BISHOP] >= 2) - (count[black][BISHOP] >= 2);
+    entry->imbalance[opening] = bishop_pairs * bishop_pair_opening;
+    entry->imbalance[endgame] = bishop_pairs * bishop_pair_endgame;
+    
+    // loop over sides to find the side with the upper hand
+    for (int strong = white; strong <= black; strong++)
+    {
+        // init pieces of both sides
+        int *own = count[strong], *other = count[strong ^ 1];
+        
+        // non pawn pieces of both sides
+        int own_minors = own[KNIGHT] + own[BISHOP], own_majors = own[ROOK] + own[QUEEN];
+        int other_minors = other[KNIGHT] + other[BISHOP], other_majors = other[ROOK] + other[QUEEN];
+        int other_pieces = other_minors + other_majors;
+        
+        // no pawns & at most a minor piece on the board: mate is impossible
+        if (own[PAWN] + other[PAWN] + own_majors + other_majors == 0 && own_minors + other_minors <= 1)
+            entry->evaluate = evaluate_insufficient;
+        
+        // no pawns & at most a minor piece each: draw
+        else if (own[PAWN] + other[PAWN] + own_majors + other_majors == 0 && own_minors <= 1 && other_minors <= 1)
+            entry->evaluate = evaluate_draw;
+        
+        // two knights against bare king: draw
+        else if (own[KNIGHT] == 2 && own[BISHOP] + own_majors + own[PAWN] == 0 && other_pieces + other[PAWN] == 0)
+            entry->evaluate = evaluate_draw;
+        
+        // bishop & knight against bare king
+        else if (own[KNIGHT] == 1 && own[BISHOP] == 1 && own_majors + own[PAWN] == 0 && other_pieces + other[PAWN] == 0)
+            entry->evaluate = evaluate_kbnk;
+        
+        // rook or queen (with anything) against bare king
+        else if (own_majors && other_pieces + other[PAWN] == 0)
+            entry->evaluate = evaluate_kxk;
+        
+        // rook against pawn
+        else if (own[ROOK] == 1 && own_minors + own[QUEEN] + own[PAWN] == 0 && other[PAWN] == 1 && other_pieces == 0)
+            entry->evaluate = evaluate_krkp;
+        
+        // evaluator found
+        if (entry->evaluate)
+        {
+            // store the side it's called for
+            entry->strong_side = strong;
+            break;
+        }
+    }
+    
+    // return analysed entry
+    return entry;
+}
+
+// material can't mate for either side
+static inline int is_material_draw()
+{
+    return probe_material()->evaluate == evaluate_insufficient;
+}
+
+// evaluate position from scratch
+static inline int evaluate_position();
+
+// position evaluation (cached)
+static inline int evaluate()
+{
+    // evaluation cache entry of the current position
+    eval_cache_entry *entry = &eval_cache[hash_key & (eval_cache_size - 1)];
+    
+    // count probe
+    eval_cache_probes++;
+    
+    // position has been evaluated before
+    if (entry->hash_key == hash_key)
+    {
+        // count hit
+        eval_cache_hits++;
+        
+        // return cached score
+        return entry->score;
+    }
+    
+    // evaluate position and overwrite the entry
+    entry->hash_key = hash_key;
+    entry->score = evaluate_position();
+    
+    // return evaluation score
+    return entry->score;
+}
+
+// lazy evaluation margin under HCE (UCI "LazyMargin" option, 0 disables lazy evaluation)
+int lazy_margin = 400;
+
+// lazy evaluation margin under NNUE (UCI "LazyMarginNNUE" option, 0 disables lazy evaluation,
+// -1 derives it from how far NNUE scores stray from the material & PST estimate)
+int lazy_margin_nnue = -1;
+
+// number of full evaluations skipped by lazy evaluation in the current search
+_Thread_local U64 lazy_eval_skips;
+
+// sum & number of NNUE score deviations from the estimate in the current search
+_Thread_local U64 lazy_error_sum;
+_Thread_local int lazy_error_count;
+
+// lazy evaluation margin under NNUE
+static inline int get_nnue_lazy_margin()
+{
+    // fixed margin
+    if (lazy_margin_nnue >= 0) return lazy_margin_nnue;
+    
+    // not enough NNUE scores seen to tell the deviation yet
+    if (lazy_error_count < 256) return 0;
+    
+    // three times the mean deviation (rarely exceeded)
+    return 3 * lazy_error_sum / lazy_error_count;
+}
+
+// material & piece-square score interpolated by game phase (cheap evaluation estimate)
+static inline int evaluate_psq()
+{
+    // get game phase score
+    int game_phase_score = get_game_phase_score();
+    
+    // evaluation score
+    int score;
+    
+    // pure opening score
+    if (game_phase_score > opening_phase_score) score = psq_score[opening];
+    
+    // pure endgame score
+    else if (game_phase_score < endgame_phase_score) score = psq_score[endgame];
+    
+    // interpolate score in the middlegame
+    else score = (
+            psq_score[opening] * game_phase_score +
+            psq_score[endgame] * (opening_phase_score - game_phase_score)
+        ) / opening_phase_score;
+    
+    // return score based on side
+    return (side == white) ? score : -score;
+}
+
+// position evaluation
+static inline int evaluate_position()
+{   
+    // look up material signature
+    material_entry *material = probe_material();
+    
+    // known endgames are scored by specialised evaluators
+    if (material->evaluate) return material->evaluate(material->strong_side);
+    
+    // get game phase score
+    int game_phase_score = material->phase;
+    
+    // game phase (opening, middle game, endgame)
+    int game_phase = -1;
+    
+    // pick up game phase based on game phase score
+    if (game_phase_score > opening_phase_score) game_phase = opening;
+    else if (game_phase_score < endgame_phase_score) game_phase = endgame;
+    else game_phase = middlegame;
+    
+    // pick up NNUE network (-1 if there's none)
+    int net = get_nnue_net(game_phase_score);
+    
+    // static evaluation score (material & piece-square score is kept up to date by make/unmake move)
+    int score = 0, score_opening = psq_score[opening], score_endgame = psq_score[endgame];
+    
+    // current pieces bitboard copy
+    U64 bitboard;
+    
+    // init piece & square
+    int piece, square;
+    
+    // array of piece codes converted to Stockfish piece codes
+    int pieces[33];
+    
+    // array of square indices converted to Stockfish square indices
+    int squares[33];
+    
+    // pieces and squares current index to write next piece square pair at
+    int index = 2;
+    
+    // loop over piece bitboards
+    for (int bb_piece = P; bb_piece <= k; bb_piece++)
+    {
+        // init piece bitboard copy
+        bitboard = bitboards[bb_piece];
+        
+        // loop over pieces within a bitboard
+        while (bitboard)
+        {
+            // init piece
+            piece = bb_piece;
+            
+            // init square
+            square = get_ls1b_index(bitboard);
+            
+            // use NNUE evaluation if a network is loaded
+            if (net >= 0)
+            {
+                /*
+                    Code to initialize pieces and squares arrays
+                    to serve the purpose of direct probing of NNUE
+                */
+                
+                // case white king
+                if (piece == K)
+                {
+                    /* convert white king piece code to stockfish piece code and
+                       store it at the first index of pieces array
+                    */ 
+                    pieces[0] = nnue_pieces[piece];
+                    
+                    /* convert white king square index to stockfish square index and
+                       store it at the first index of pieces array
+                    */
+                    squares[0] = nnue_squares[square];
+                }
+                
+                // case black king
+                else if (piece == k)
+                {
+                    /* convert black king piece code to stockfish piece code and
+                       store it at the second index of pieces array
+                    */
+                    pieces[1] = nnue_pieces[piece];
+                    
+                    /* convert black king square index to stockfish square index and
+                       store it at the second index of pieces array
+                    */
+                    squares[1] = nnue_squares[square];
+                }
+                
+                // all the rest pieces
+                else
+                {
+                    /*  convert all the rest of piece code with corresponding square codes
+                        to stockfish piece codes and square indicies respectively
+                    */
+                    pieces[index] = nnue_pieces[piece];
+                    squares[index] = nnue_squares[square];
+                    index++;    
+                }
+            }
+            
+            // otherwise use handcrafted evaluation
+            else
+            {
+                // score mobility, open files & king safety
+                switch (piece)
+                {
+                    // evaluate white bishops
+                    case B:
+                        // mobility
+                        score_opening += (count_bits(get_bishop_attacks(square, occupancies[both])) - bishop_unit) * bishop_mobility_opening;
+                        score_endgame += (count_bits(get_bishop_attacks(square, occupancies[both])) - bishop_unit) * bishop_mobility_endgame;                    
+                        break;
+                    
+                    // evaluate white rooks
+                    case R:
+                        // semi open file
+                        if ((bitboards[P] & file_masks[square]) == 0)
+                        {
+                            // add semi open file bonus
+                            score_opening += semi_open_file_score;
+                            score_endgame += semi_open_file_score;
+                        }
+                        
+                        // semi open file
+                        if (((bitboards[P] | bitboards[p]) & file_masks[square]) == 0)
+                        {
+                            // add semi open file bonus
+                            score_opening += open_file_score;
+                            score_endgame += open_file_score;
+                        }
+                        
+                        break;
                     
                     // evaluate white queens
                     case Q:
-                        // get opening/endgame positional score
-                        score_opening += positional_score[opening][QUEEN][square];
-                        score_endgame += positional_score[endgame][QUEEN][square];
-                        
                         // mobility
                         score_opening += (count_bits(get_queen_attacks(square, occupancies[both])) - queen_unit) * queen_mobility_opening;
                         score_endgame += (count_bits(get_queen_attacks(square, occupancies[both])) - queen_unit) * queen_mobility_endgame;                    
@@ -3293,10 +5129,6 @@ static inline int evaluate()
                     
                     // evaluate white king
                     case K:
-                        // get opening/endgame positional score
-                        score_opening += positional_score[opening][KING][square];
-                        score_endgame += positional_score[endgame][KING][square];
-                        
                         // semi open file
                         if ((bitboards[P] & file_masks[square]) == 0)
                         {
@@ -3319,53 +5151,8 @@ static inline int evaluate()
                         
                         break;
 
-                    // evaluate black pawns
-                    case p:
-                        // get opening/endgame positional score
-                        score_opening -= positional_score[opening][PAWN][mirror_score[square]];
-                        score_endgame -= positional_score[endgame][PAWN][mirror_score[square]];
-                        
-                        // double pawn penalty
-                        double_pawns = count_bits(bitboards[p] & file_masks[square]);
-                        
-                        // on double pawns (tripple, etc)
-                        if (double_pawns > 1)
-                        {
-                            score_opening -= (double_pawns - 1) * double_pawn_penalty_opening;
-                            score_endgame -= (double_pawns - 1) * double_pawn_penalty_endgame;
-                        }
-                        
-                        // on isolated pawn
-                        if ((bitboards[p] & isolated_masks[square]) == 0)
-                        {
-                            // give an isolated pawn penalty
-                            score_opening -= isolated_pawn_penalty_opening;
-                            score_endgame -= isolated_pawn_penalty_endgame;
-                        }
-                        // on passed pawn
-                        if ((black_passed_masks[square] & bitboards[P]) == 0)
-                        {
-                            // give passed pawn bonus
-                            score_opening -= passed_pawn_bonus[get_rank[square]];
-                            score_endgame -= passed_pawn_bonus[get_rank[square]];
-                        }
-                        
-                        break;
-                    
-                    // evaluate black knights
-                    case n:
-                        // get opening/endgame positional score
-                        score_opening -= positional_score[opening][KNIGHT][mirror_score[square]];
-                        score_endgame -= positional_score[endgame][KNIGHT][mirror_score[square]];
-                        
-                        break;
-                    
                     // evaluate black bishops
                     case b:
-                        // get opening/endgame positional score
-                        score_opening -= positional_score[opening][BISHOP][mirror_score[square]];
-                        score_endgame -= positional_score[endgame][BISHOP][mirror_score[square]];
-                        
                         // mobility
                         score_opening -= (count_bits(get_bishop_attacks(square, occupancies[both])) - bishop_unit) * bishop_mobility_opening;
                         score_endgame -= (count_bits(get_bishop_attacks(square, occupancies[both])) - bishop_unit) * bishop_mobility_endgame;                    
@@ -3373,10 +5160,6 @@ static inline int evaluate()
                     
                     // evaluate black rooks
                     case r:
-                        // get opening/endgame positional score
-                        score_opening -= positional_score[opening][ROOK][mirror_score[square]];
-                        score_endgame -= positional_score[endgame][ROOK][mirror_score[square]];
-                        
                         // semi open file
                         if ((bitboards[p] & file_masks[square]) == 0)
                         {
@@ -3397,10 +5180,6 @@ static inline int evaluate()
                     
                     // evaluate black queens
                     case q:
-                        // get opening/endgame positional score
-                        score_opening -= positional_score[opening][QUEEN][mirror_score[square]];
-                        score_endgame -= positional_score[endgame][QUEEN][mirror_score[square]];
-                        
                         // mobility
                         score_opening -= (count_bits(get_queen_attacks(square, occupancies[both])) - queen_unit) * queen_mobility_opening;
                         score_endgame -= (count_bits(get_queen_attacks(square, occupancies[both])) - queen_unit) * queen_mobility_endgame;                    
@@ -3408,10 +5187,6 @@ static inline int evaluate()
                     
                     // evaluate black king
                     case k:
-                        // get opening/endgame positional score
-                        score_opening -= positional_score[opening][KING][mirror_score[square]];
-                        score_endgame -= positional_score[endgame][KING][mirror_score[square]];
-                        
                         // semi open file
                         if ((bitboards[p] & file_masks[square]) == 0)
                         {
@@ -3444,9 +5219,6 @@ static inline int evaluate()
     pieces[index] = 0;
     squares[index] = 0;
     
-    // get NNUE score (final score! No need to adjust by the side!)
-    int nnue_score = evaluate_nnue(side, pieces, squares);
-    
     /*          
         Now in order to calculate interpolated score
         for a given game phase we use this formula
@@ -3461,8 +5233,29 @@ static inline int evaluate()
         interpolated_score = (12 * 5000 + (-7) * (6192 - 5000)) / 6192 = 8,342377261
     */
     
+    if (net >= 0)
+    {
+        // evaluate with the picked network
+        use_nnue_net(net);
+        
+        // NNUE data of the current and two previous plies
+        nnue_data();
+        
+        // get NNUE score (final score! No need to adjust by the side!)
+        return evaluate_nnue_incremental(side, pieces, squares, nnue);
+    }
+    
+    // add pawn structure score
+    pawn_entry *pawns = evaluate_pawns();
+    score_opening += pawns->score_opening;
+    score_endgame += pawns->score_endgame;
+    
+    // add material imbalance score
+    score_opening += material->imbalance[opening];
+    score_endgame += material->imbalance[endgame];
+    
     // interpolate score in the middlegame
-    /*if (game_phase == middlegame)
+    if (game_phase == middlegame)
         score = (
             score_opening * game_phase_score +
             score_endgame * (opening_phase_score - game_phase_score)
@@ -3475,14 +5268,7 @@ static inline int evaluate()
     else if (game_phase == endgame) score = score_endgame;
     
     // return final evaluation based on side
-    //return (side == white) ? score : -score;
-    */
-    
-    if (game_phase != endgame)
-        return nnue_score;
-    
-    else
-        return (side == white) ? score_endgame : -score_endgame;
+    return (side == white) ? score : -score;
 }
 
 
@@ -3535,14 +5321,11 @@ static int mvv_lva[12][12] = {
 	100, 200, 300, 400, 500, 600,  100, 200, 300, 400, 500, 600
 };
 
-// max ply that we can reach within a search
-#define max_ply 64
-
 // killer moves [id][ply]
-int killer_moves[2][max_ply];
+_Thread_local int killer_moves[2][max_ply];
 
 // history moves [piece][square]
-int history_moves[12][64];
+_Thread_local int history_moves[12][64];
 
 /*
       ================================
@@ -3567,13 +5350,13 @@ int history_moves[12][64];
 */
 
 // PV length [ply]
-int pv_length[max_ply];
+_Thread_local int pv_length[max_ply];
 
 // PV table [ply][ply]
-int pv_table[max_ply][max_ply];
+_Thread_local int pv_table[max_ply][max_ply];
 
-// follow PV & score PV move
-int follow_pv, score_pv;
+// follow PV flag
+_Thread_local int follow_pv;
 
 
 /**********************************\
@@ -3584,9 +5367,31 @@ int follow_pv, score_pv;
  ==================================
 \**********************************/
 
+/*
+    The table is split into 64 byte buckets so that a single probe
+    touches exactly one cache line. Each bucket holds 4 entries of
+    16 bytes: the packed entry data plus the hash key XORed with it.
+    Threads read and write entries without any locking, an entry
+    torn by a concurrent write simply fails key verification.
+
+    packed entry data (64 bits)
+    
+    0000 0000 0000 0000 0000 0000 0000 0000 0000 0000 1111 1111 1111 1111 1111 1111    best move       0xffffff
+    0000 0000 0000 0000 0000 0000 1111 1111 0000 0000 0000 0000 0000 0000 0000 0000    depth           0xff
+    0000 0000 0000 0000 0000 0011 0000 0000 0000 0000 0000 0000 0000 0000 0000 0000    flag            0x3
+    0000 0000 0000 0000 1111 1100 0000 0000 0000 0000 0000 0000 0000 0000 0000 0000    age             0x3f
+    1111 1111 1111 1111 0000 0000 0000 0000 0000 0000 0000 0000 0000 0000 0000 0000    score (signed)  top 24 bits
+*/
+
 // number hash table entries
 int hash_entries = 0;
 
+// number of hash table buckets minus 1 (number of buckets is a power of 2)
+U64 hash_mask = 0;
+
+// search generation used to age out entries from older searches
+int hash_age = 0;
+
 // no hash entry found constant
 #define no_hash_entry 100000
 
@@ -3595,42 +5400,65 @@ int hash_entries = 0;
 #define hash_flag_alpha 1
 #define hash_flag_beta 2
 
+// number of entries within a bucket
+#define bucket_size 4
+
+// pack TT entry data
+#define encode_hash_data(move, depth, flag, age, score) \
+    (                                                   \
+     (U64)(move) |                                      \
+     ((U64)(depth) << 24) |                             \
+     ((U64)(flag) << 32) |                              \
+     ((U64)(age) << 34) |                               \
+     ((U64)((score) & 0xffffff) << 40)                  \
+    )
+
+// extract TT entry data
+#define get_hash_move(data) ((int)((data) & 0xffffff))
+#define get_hash_depth(data) ((int)(((data) >> 24) & 0xff))
+#define get_hash_flag(data) ((int)(((data) >> 32) & 0x3))
+#define get_hash_age(data) ((int)(((data) >> 34) & 0x3f))
+#define get_hash_score(data) ((int)((long long)(data) >> 40))
+
 // transposition table data structure
 typedef struct {
-    U64 hash_key;   // "almost" unique chess position identifier
-    int depth;      // current search depth
-    int flag;       // flag the type of node (fail-low/fail-high/PV) 
-    int score;      // score (alpha/beta/PV)
+    U64 hash_lock;  // "almost" unique chess position identifier XORed with data
+    U64 data;       // packed best move, depth, flag, age and score
 } tt;               // transposition table (TT aka hash table)
 
+// transposition table bucket (one cache line)
+typedef struct {
+    tt entries[bucket_size];
+} tt_bucket __attribute__((aligned(64)));
+
 // define TT instance
-tt *hash_table = NULL;
+tt_bucket *hash_table = NULL;
 
 // clear TT (hash table)
 void clear_hash_table()
 {
-    // init hash table entry pointer
-    tt *hash_entry;
-
-    // loop over TT elements
-    for (hash_entry = hash_table; hash_entry < hash_table + hash_entries; hash_entry++)
-    {
-        // reset TT inner fields
-        hash_entry->hash_key = 0;
-        hash_entry->depth = 0;
-        hash_entry->flag = 0;
-        hash_entry->score = 0;
-    }
+    // reset all the buckets
+    memset(hash_table, 0, (hash_mask + 1) * sizeof(tt_bucket));
+    
+    // reset search generation
+    hash_age = 0;
 }
 
 // dynamically allocate memory for hash table
 void init_hash_table(int mb)
 {
     // init hash size
-    int hash_size = 0x100000 * mb;
+    U64 hash_size = 0x100000ULL * mb;
+    
+    // init number of hash buckets (round down to the power of 2)
+    U64 buckets = 1;
+    while (buckets * 2 * sizeof(tt_bucket) <= hash_size) buckets *= 2;
+    
+    // init bucket index mask
+    hash_mask = buckets - 1;
     
     // init number of hash entries
-    hash_entries =  hash_size / sizeof(tt);
+    hash_entries = buckets * bucket_size;
 
     // free hash table if not empty
     if (hash_table != NULL)
@@ -3641,8 +5469,8 @@ void init_hash_table(int mb)
         free(hash_table);
     }
      
-    // allocate memory
-    hash_table = (tt *) malloc(hash_entries * sizeof(tt));
+    // allocate cache line aligned memory
+    hash_table = (tt_bucket *) aligned_alloc(64, buckets * sizeof(tt_bucket));
 
     // if allocation has failed
     if (hash_table == NULL)
@@ -3666,20 +5494,32 @@ void init_hash_table(int mb)
 }
 
 // read hash entry data
-static inline int read_hash_entry(int alpha, int beta, int depth)
+static inline int read_hash_entry(int alpha, int beta, int *best_move, int depth)
 {
-    // create a TT instance pointer to particular hash entry storing
-    // the scoring data for the current board position if available
-    tt *hash_entry = &hash_table[hash_key % hash_entries];
+    // pick up the bucket the current board position belongs to
+    tt_bucket *bucket = &hash_table[hash_key & hash_mask];
     
-    // make sure we're dealing with the exact position we need
-    if (hash_entry->hash_key == hash_key)
+    // loop over bucket entries
+    for (int index = 0; index < bucket_size; index++)
     {
+        // read entry data once, it might be overwritten by another thread
+        U64 data = bucket->entries[index].data;
+        
+        // make sure we're dealing with the exact position we need
+        if ((bucket->entries[index].hash_lock ^ data) != hash_key)
+            continue;
+        
+        // store best move
+        *best_move = get_hash_move(data);
+        
         // make sure that we match the exact depth our search is now at
-        if (hash_entry->depth >= depth)
+        if (get_hash_depth(data) >= depth)
         {
             // extract stored score from TT entry
-            int score = hash_entry->score;
+            int score = get_hash_score(data);
+            
+            // extract stored flag from TT entry
+            int flag = get_hash_flag(data);
             
             // retrieve score independent from the actual path
             // from root node (position) to current node (position)
@@ -3687,22 +5527,25 @@ static inline int read_hash_entry(int alpha, int beta, int depth)
             if (score > mate_score) score -= ply;
         
             // match the exact (PV node) score 
-            if (hash_entry->flag == hash_flag_exact)
+            if (flag == hash_flag_exact)
                 // return exact (PV node) score
                 return score;
             
             // match alpha (fail-low node) score
-            if ((hash_entry->flag == hash_flag_alpha) &&
+            if ((flag == hash_flag_alpha) &&
                 (score <= alpha))
                 // return alpha (fail-low node) score
                 return alpha;
             
             // match beta (fail-high node) score
-            if ((hash_entry->flag == hash_flag_beta) &&
+            if ((flag == hash_flag_beta) &&
                 (score >= beta))
                 // return beta (fail-high node) score
                 return beta;
         }
+        
+        // position found but score can't be used
+        break;
     }
     
     // if hash entry doesn't exist
@@ -3710,154 +5553,258 @@ static inline int read_hash_entry(int alpha, int beta, int depth)
 }
 
 // write hash entry data
-static inline void write_hash_entry(int score, int depth, int hash_flag)
+static inline void write_hash_entry(int score, int best_move, int depth, int hash_flag)
 {
-    // create a TT instance pointer to particular hash entry storing
-    // the scoring data for the current board position if available
-    tt *hash_entry = &hash_table[hash_key % hash_entries];
+    // pick up the bucket the current board position belongs to
+    tt_bucket *bucket = &hash_table[hash_key & hash_mask];
+    
+    // entry to replace
+    tt *hash_entry = &bucket->entries[0];
+    
+    // lowest replacement value so far
+    int lowest_value = 1000;
+    
+    // loop over bucket entries
+    for (int index = 0; index < bucket_size; index++)
+    {
+        // init current entry
+        tt *entry = &bucket->entries[index];
+        U64 data = entry->data;
+        
+        // always overwrite the same position
+        if ((entry->hash_lock ^ data) == hash_key)
+        {
+            // preserve existing best move if we don't have one
+            if (best_move == 0) best_move = get_hash_move(data);
+            
+            hash_entry = entry;
+            break;
+        }
+        
+        // prefer replacing shallow entries left from older searches
+        int value = get_hash_depth(data) - 8 * ((hash_age - get_hash_age(data)) & 0x3f);
+        
+        // found a better candidate to replace
+        if (value < lowest_value)
+        {
+            lowest_value = value;
+            hash_entry = entry;
+        }
+    }
 
     // store score independent from the actual path
     // from root node (position) to current node (position)
     if (score < -mate_score) score -= ply;
     if (score > mate_score) score += ply;
+    
+    // pack hash entry data
+    U64 data = encode_hash_data(best_move, depth, hash_flag, hash_age, score);
 
     // write hash entry data 
-    hash_entry->hash_key = hash_key;
-    hash_entry->score = score;
-    hash_entry->flag = hash_flag;
-    hash_entry->depth = depth;
-}
-
-// enable PV move scoring
-static inline void enable_pv_scoring(moves *move_list)
-{
-    // disable following PV
-    follow_pv = 0;
-    
-    // loop over the moves within a move list
-    for (int count = 0; count < move_list->count; count++)
-    {
-        // make sure we hit PV move
-        if (pv_table[0][ply] == move_list->moves[count])
-        {
-            // enable move scoring
-            score_pv = 1;
-            
-            // enable following PV
-            follow_pv = 1;
-        }
-    }
+    hash_entry->hash_lock = hash_key ^ data;
+    hash_entry->data = data;
 }
 
 /*  =======================
          Move ordering
     =======================
     
-    1. PV move
-    2. Captures in MVV/LVA
+    Moves are generated and picked lazily one at a time in stages,
+    so no moves get generated or sorted in vain when a beta cutoff happens
+    
+    1. Hash move (PV move when following PV)
+    2. Captures in MVV/LVA (and promotions)
     3. 1st killer move
     4. 2nd killer move
     5. History moves
-    6. Unsorted moves
+    
+    When in check hash move is followed by check evasions
+    (captures in MVV/LVA, then history moves)
 */
 
+// move picker stages
+enum {
+    pick_hash_move, pick_generate_captures, pick_captures, pick_killers,
+    pick_generate_quiets, pick_quiets, pick_generate_evasions, pick_evasions, pick_done
+};
+
+// move picker data structure
+typedef struct {
+    int stage;            // current move picking stage
+    int hash_move;        // move to search first
+    int only_captures;    // skip quiet moves (quiescence search)
+    int in_check;         // generate check evasions only
+    int killers[2];       // killer moves already picked
+    int killer;           // next killer move index
+    int current;          // next move index within the move list
+    int scores[256];      // move scores
+    moves move_list[1];   // moves generated for the current stage
+} move_picker;
+
 // score moves
 static inline int score_move(int move)
 {
-    // if PV move scoring is allowed
-    if (score_pv)
-    {
-        // make sure we are dealing with PV move
-        if (pv_table[0][ply] == move)
-        {
-            // disable score PV flag
-            score_pv = 0;
-            
-            // give PV move the highest score to search it first
-            return 20000;
-        }
-    }
-    
     // score capture move
     if (get_move_capture(move))
     {
-        // init target piece
-        int target_piece = P;
-        
-        // pick up bitboard piece index ranges depending on side
-        int start_piece, end_piece;
-        
-        // pick up side to move
-        if (side == white) { start_piece = p; end_piece = k; }
-        else { start_piece = P; end_piece = K; }
-        
-        // loop over bitboards opposite to the current side to move
-        for (int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
-        {
-            // if there's a piece on the target square
-            if (get_bit(bitboards[bb_piece], get_move_target(move)))
-            {
-                // remove it from corresponding bitboard
-                target_piece = bb_piece;
-                break;
-            }
-        }
+        // init target piece (enpassant target square is empty)
+        int target_piece = board[get_move_target(move)];
+        if (target_piece == -1) target_piece = P;
                 
         // score move by MVV LVA lookup [source piece][target piece]
         return mvv_lva[get_move_piece(move)][target_piece] + 10000;
     }
     
-    // score quiet move
+    // score quiet move by history
     else
+        return history_moves[get_move_piece(move)][get_move_target(move)];
+}
+
+// init move picker
+static inline void init_move_picker(move_picker *picker, int hash_move, int only_captures, int in_check)
+{
+    picker->stage = in_check ? pick_generate_evasions : pick_generate_captures;
+    picker->hash_move = 0;
+    picker->only_captures = only_captures;
+    picker->in_check = in_check;
+    picker->killers[0] = picker->killers[1] = 0;
+    picker->killer = 0;
+    picker->current = 0;
+    
+    // make sure hash move can be made in the current position
+    if (is_legal(hash_move))
+    {
+        // pick hash move first
+        picker->hash_move = hash_move;
+        picker->stage = pick_hash_move;
+    }
+}
+
+// generate and score moves for the next stage
+static inline void generate_stage_moves(move_picker *picker, int move_type)
+{
+    // generate moves
+    generate_moves(picker->move_list, move_type);
+    
+    // score moves
+    for (int index = 0; index < picker->move_list->count; index++)
+        picker->scores[index] = score_move(picker->move_list->moves[index]);
+    
+    // start from the first move
+    picker->current = 0;
+}
+
+// pick the highest scored move left within the current stage
+static inline int pick_best_move(move_picker *picker)
+{
+    // loop over moves left
+    while (picker->current < picker->move_list->count)
     {
-        // score 1st killer move
-        if (killer_moves[0][ply] == move)
-            return 9000;
+        // find the best scored move
+        int best = picker->current;
         
-        // score 2nd killer move
-        else if (killer_moves[1][ply] == move)
-            return 8000;
+        for (int index = picker->current + 1; index < picker->move_list->count; index++)
+            if (picker->scores[index] > picker->scores[best])
+                best = index;
         
-        // score history move
-        else
-            return history_moves[get_move_piece(move)][get_move_target(move)];
+        // swap it with the current move
+        int move = picker->move_list->moves[best];
+        picker->move_list->moves[best] = picker->move_list->moves[picker->current];
+        picker->scores[best] = picker->scores[picker->current];
+        picker->current++;
+        
+        // hash move and killer moves have already been searched
+        if (move != picker->hash_move && move != picker->killers[0] && move != picker->killers[1])
+            return move;
     }
     
+    // no moves left
     return 0;
 }
 
-// sort moves in descending order
-static inline int sort_moves(moves *move_list)
+// pick next move to search (returns 0 when there are no moves left)
+static inline int next_move(move_picker *picker)
 {
-    // move scores
-    int move_scores[move_list->count];
-    
-    // score all the moves within a move list
-    for (int count = 0; count < move_list->count; count++)
-        // score move
-        move_scores[count] = score_move(move_list->moves[count]);
+    // pick up move
+    int move;
     
-    // loop over current move within a move list
-    for (int current_move = 0; current_move < move_list->count; current_move++)
+    switch (picker->stage)
     {
-        // loop over next move within a move list
-        for (int next_move = current_move + 1; next_move < move_list->count; next_move++)
-        {
-            // compare current and next move scores
-            if (move_scores[current_move] < move_scores[next_move])
+        // search hash move before generating anything
+        case pick_hash_move:
+            picker->stage = picker->in_check ? pick_generate_evasions : pick_generate_captures;
+            return picker->hash_move;
+        
+        // generate captures and promotions
+        case pick_generate_captures:
+            generate_stage_moves(picker, generate_captures);
+            picker->stage = pick_captures;
+            /* fall through */
+        
+        // captures in MVV/LVA order
+        case pick_captures:
+            if ((move = pick_best_move(picker)))
+                return move;
+            
+            // quiescence search is done
+            if (picker->only_captures)
+            {
+                picker->stage = pick_done;
+                return 0;
+            }
+            
+            picker->stage = pick_killers;
+            /* fall through */
+        
+        // killer moves
+        case pick_killers:
+            while (picker->killer < 2)
             {
-                // swap scores
-                int temp_score = move_scores[current_move];
-                move_scores[current_move] = move_scores[next_move];
-                move_scores[next_move] = temp_score;
+                // init killer move
+                move = killer_moves[picker->killer][ply];
+                
+                // quiet promotions are picked up with captures
+                if (move != picker->hash_move && get_move_promoted(move) == 0 && is_legal(move))
+                    // pick killer move
+                    return picker->killers[picker->killer++] = move;
                 
-                // swap moves
-                int temp_move = move_list->moves[current_move];
-                move_list->moves[current_move] = move_list->moves[next_move];
-                move_list->moves[next_move] = temp_move;
+                // try next killer move
+                picker->killer++;
             }
-        }
+            
+            picker->stage = pick_generate_quiets;
+            /* fall through */
+        
+        // generate quiet moves
+        case pick_generate_quiets:
+            generate_stage_moves(picker, generate_quiets);
+            picker->stage = pick_quiets;
+            /* fall through */
+        
+        // quiet moves in history order
+        case pick_quiets:
+            if ((move = pick_best_move(picker)))
+                return move;
+            
+            picker->stage = pick_done;
+            return 0;
+        
+        // generate check evasions
+        case pick_generate_evasions:
+            generate_stage_moves(picker, generate_evasions);
+            picker->stage = pick_evasions;
+            /* fall through */
+        
+        // check evasions (captures first, then history moves)
+        case pick_evasions:
+            if ((move = pick_best_move(picker)))
+                return move;
+            
+            picker->stage = pick_done;
     }
+    
+    // no moves left
+    return 0;
 }
 
 // print move scores
@@ -3880,7 +5827,7 @@ static inline int is_repetition()
     // loop over repetition indicies range
     for (int index = 0; index < repetition_index; index++)
         // if we found the hash key same with a current
-        if (repetition_table[index] == hash_key)
+        if (undo_stack[index].hash_key == hash_key)
             // we found a repetition
             return 1;
     
@@ -3893,8 +5840,8 @@ static inline int quiescence(int alpha, int beta)
 {
     // every 2047 nodes
     if((nodes & 2047 ) == 0)
-        // "listen" to the GUI/user input
-		communicate();
+        // check whether the time is up
+		check_time();
 	
     // increment nodes count
     nodes++;
@@ -3904,8 +5851,35 @@ static inline int quiescence(int alpha, int beta)
         // evaluate position
         return evaluate();
 
-    // evaluate position
-    int evaluation = evaluate();
+    // neither side has enough material to mate
+    if (is_material_draw())
+        // return draw score
+        return 0;
+    
+    // estimate evaluation by material & piece-square score first
+    int estimate = evaluate_psq(), evaluation = estimate;
+    
+    // NNUE scores stray further from the estimate than HCE ones
+    int nnue = get_nnue_net(get_game_phase_score()) >= 0;
+    int margin = nnue ? get_nnue_lazy_margin() : lazy_margin;
+    
+    // estimate is far outside the window, full evaluation wouldn't change the outcome
+    if (margin && (estimate - margin >= beta || estimate + margin <= alpha))
+        // count skipped evaluation
+        lazy_eval_skips++;
+    
+    // otherwise evaluate position
+    else
+    {
+        evaluation = evaluate();
+        
+        // keep track of NNUE deviation from the estimate
+        if (nnue)
+        {
+            lazy_error_sum += abs(evaluation - estimate);
+            lazy_error_count++;
+        }
+    }
     
     // fail-hard beta cutoff
     if (evaluation >= beta)
@@ -3921,38 +5895,25 @@ static inline int quiescence(int alpha, int beta)
         alpha = evaluation;
     }
     
-    // create move list instance
-    moves move_list[1];
-    
-    // generate moves
-    generate_moves(move_list);
+    // init move picker for captures and promotions
+    move_picker picker[1];
+    init_move_picker(picker, 0, 1, 0);
     
-    // sort moves
-    sort_moves(move_list);
+    // current move
+    int move;
     
-    // loop over moves within a movelist
-    for (int count = 0; count < move_list->count; count++)
+    // loop over captures and promotions
+    while ((move = next_move(picker)))
     {
-        // preserve board state
-        copy_board();
-        
         // increment ply
         ply++;
         
-        // increment repetition index & store hash key
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-
-        
         // make sure to make only legal moves
-        if (make_move(move_list->moves[count], only_captures) == 0)
+        if (make_move(move, all_moves) == 0)
         {
             // decrement ply
             ply--;
             
-            // decrement repetition index
-            repetition_index--;
-            
             // skip to next move
             continue;
         }
@@ -3963,11 +5924,8 @@ static inline int quiescence(int alpha, int beta)
         // decrement ply
         ply--;
         
-        // decrement repetition index
-        repetition_index--;
-
         // take move back
-        take_back();
+        unmake_move();
         
         // reutrn 0 if time is up
         if(stopped == 1) return 0;
@@ -4009,6 +5967,9 @@ static inline int negamax(int alpha, int beta, int depth)
     // define hash flag
     int hash_flag = hash_flag_alpha;
     
+    // best move to store in the hash table
+    int best_move = 0;
+    
     // if position repetition occurs
     if (ply && is_repetition())
         // return draw score
@@ -4019,15 +5980,15 @@ static inline int negamax(int alpha, int beta, int depth)
     
     // read hash entry if we're not in a root ply and hash entry is available
     // and current node is not a PV node
-    if (ply && (score = read_hash_entry(alpha, beta, depth)) != no_hash_entry && pv_node == 0)
+    if (ply && (score = read_hash_entry(alpha, beta, &best_move, depth)) != no_hash_entry && pv_node == 0)
         // if the move has already been searched (hence has a value)
         // we just return the score for this move without searching it
         return score;
         
     // every 2047 nodes
     if((nodes & 2047 ) == 0)
-        // "listen" to the GUI/user input
-		communicate();
+        // check whether the time is up
+		check_time();
 
     // recursion escapre condition
     if (depth == 0)
@@ -4042,6 +6003,9 @@ static inline int negamax(int alpha, int beta, int depth)
     // increment nodes count
     nodes++;
     
+    // compute NNUE accumulator for the child nodes to update from
+    update_nnue_accumulator();
+    
     // is king in check
     int in_check = is_square_attacked((side == white) ? get_ls1b_index(bitboards[K]) : 
                                                         get_ls1b_index(bitboards[k]),
@@ -4050,34 +6014,22 @@ static inline int negamax(int alpha, int beta, int depth)
     // increase search depth if the king has been exposed into a check
     if (in_check) depth++;
     
+    // if neither side has enough material to mate (checks are searched out first)
+    if (ply && in_check == 0 && is_material_draw())
+        // return draw score
+        return 0;
+    
     // legal moves counter
     int legal_moves = 0;
     
     // null move pruning
     if (depth >= 3 && in_check == 0 && ply)
     {
-        // preserve board state
-        copy_board();
-        
         // increment ply
         ply++;
         
-        // increment repetition index & store hash key
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-
-        
-        // hash enpassant if available
-        if (enpassant != no_sq) hash_key ^= enpassant_keys[enpassant];
-        
-        // reset enpassant capture square
-        enpassant = no_sq;
-        
-        // switch the side, literally giving opponent an extra move to make
-        side ^= 1;
-        
-        // hash the side
-        hash_key ^= side_key;
+        // give opponent an extra move to make
+        make_null_move();
                 
         /* search moves with reduced depth to find beta cutoffs
            depth - 1 - R where R is a reduction limit */
@@ -4086,11 +6038,8 @@ static inline int negamax(int alpha, int beta, int depth)
         // decrement ply
         ply--;
         
-        // decrement repetition index
-        repetition_index--;
-            
         // restore board state
-        take_back();
+        unmake_null_move();
 
         // reutrn 0 if time is up
         if(stopped == 1) return 0;
@@ -4101,45 +6050,41 @@ static inline int negamax(int alpha, int beta, int depth)
             return beta;
     }
     
-    // create move list instance
-    moves move_list[1];
-    
-    // generate moves
-    generate_moves(move_list);
+    // move to search first
+    int hash_move = best_move;
     
     // if we are now following PV line
     if (follow_pv)
-        // enable PV move scoring
-        enable_pv_scoring(move_list);
+    {
+        // keep following PV only if PV move is available in the current position
+        follow_pv = is_legal(pv_table[0][ply]);
+        
+        // search PV move first
+        if (follow_pv) hash_move = pv_table[0][ply];
+    }
     
-    // sort moves
-    sort_moves(move_list);
+    // init move picker
+    move_picker picker[1];
+    init_move_picker(picker, hash_move, 0, in_check);
+    
+    // current move
+    int move;
     
     // number of moves searched in a move list
     int moves_searched = 0;
     
-    // loop over moves within a movelist
-    for (int count = 0; count < move_list->count; count++)
+    // loop over moves picked one by one
+    while ((move = next_move(picker)))
     {
-        // preserve board state
-        copy_board();
-        
         // increment ply
         ply++;
         
-        // increment repetition index & store hash key
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-        
         // make sure to make only legal moves
-        if (make_move(move_list->moves[count], all_moves) == 0)
+        if (make_move(move, all_moves) == 0)
         {
             // decrement ply
             ply--;
             
-            // decrement repetition index
-            repetition_index--;
-            
             // skip to next move
             continue;
         }
@@ -4160,8 +6105,8 @@ static inline int negamax(int alpha, int beta, int depth)
                 moves_searched >= full_depth_moves &&
                 depth >= reduction_limit &&
                 in_check == 0 && 
-                get_move_capture(move_list->moves[count]) == 0 &&
-                get_move_promoted(move_list->moves[count]) == 0
+                get_move_capture(move) == 0 &&
+                get_move_promoted(move) == 0
               )
                 // search current move with reduced depth:
                 score = -negamax(-alpha - 1, -alpha, depth - 2);
@@ -4193,11 +6138,8 @@ static inline int negamax(int alpha, int beta, int depth)
         // decrement ply
         ply--;
         
-        // decrement repetition index
-        repetition_index--;
-
         // take move back
-        take_back();
+        unmake_move();
         
         // reutrn 0 if time is up
         if(stopped == 1) return 0;
@@ -4211,17 +6153,20 @@ static inline int negamax(int alpha, int beta, int depth)
             // switch hash flag from storing score for fail-low node
             // to the one storing score for PV node
             hash_flag = hash_flag_exact;
+            
+            // store best move
+            best_move = move;
         
             // on quiet moves
-            if (get_move_capture(move_list->moves[count]) == 0)
+            if (get_move_capture(move) == 0)
                 // store history moves
-                history_moves[get_move_piece(move_list->moves[count])][get_move_target(move_list->moves[count])] += depth;
+                history_moves[get_move_piece(move)][get_move_target(move)] += depth;
             
             // PV node (position)
             alpha = score;
             
             // write PV move
-            pv_table[ply][ply] = move_list->moves[count];
+            pv_table[ply][ply] = move;
             
             // loop over the next ply
             for (int next_ply = ply + 1; next_ply < pv_length[ply + 1]; next_ply++)
@@ -4235,14 +6180,14 @@ static inline int negamax(int alpha, int beta, int depth)
             if (score >= beta)
             {
                 // store hash entry with the score equal to beta
-                write_hash_entry(beta, depth, hash_flag_beta);
+                write_hash_entry(beta, best_move, depth, hash_flag_beta);
             
                 // on quiet moves
-                if (get_move_capture(move_list->moves[count]) == 0)
+                if (get_move_capture(move) == 0)
                 {
                     // store killer moves
                     killer_moves[1][ply] = killer_moves[0][ply];
-                    killer_moves[0][ply] = move_list->moves[count];
+                    killer_moves[0][ply] = move;
                 }
                 
                 // node (position) fails high
@@ -4265,31 +6210,100 @@ static inline int negamax(int alpha, int beta, int depth)
             return 0;
     }
     
-    // store hash entry with the score equal to alpha
-    write_hash_entry(alpha, depth, hash_flag);
+    // store hash entry with the score equal to alpha
+    write_hash_entry(alpha, best_move, depth, hash_flag);
+    
+    // node (position) fails low
+    return alpha;
+}
+
+/**********************************\
+ ==================================
+ 
+             Lazy SMP
+ 
+ ==================================
+\**********************************/
+
+/*
+    Helper threads search the same root position as the main thread
+    sharing the transposition table with it. Helpers don't report
+    anything, they only fill the hash table with the scores the main
+    thread can then pick up. Since the threads run at different speeds
+    they quickly get out of sync and explore different parts of the tree.
+*/
+
+// max number of search threads
+#define max_threads 128
+
+// number of search threads (UCI "Threads" option)
+int threads = 1;
+
+// search thread data
+typedef struct {
+    int id;             // thread index
+    int depth;          // depth to search
+    _Atomic U64 nodes;  // nodes searched by the thread (published while searching)
+    U64 eval_probes;    // evaluation cache probes of the thread when it's done
+    U64 eval_hits;      // evaluation cache hits of the thread when it's done
+    U64 lazy_skips;     // evaluations skipped by lazy evaluation when it's done
+    pthread_t handle;   // thread handle
+} search_thread;
+
+// helper threads
+search_thread helper_threads[max_threads];
+
+// root position helper threads start searching from
+position root_position;
+
+// evaluation cache counters of all the threads in the last search
+U64 search_eval_probes, search_eval_hits;
+
+// evaluations skipped by lazy evaluation in all the threads in the last search
+U64 search_lazy_skips;
+
+// best move & expected reply to ponder on from the last completed iteration of the main thread
+int search_best_move, search_ponder_move;
+
+// sum up nodes searched by all the threads
+U64 total_nodes()
+{
+    // main thread nodes
+    U64 total = nodes;
+    
+    // loop over helper threads
+    for (int id = 1; id < threads; id++)
+        // add helper thread nodes published so far
+        total += atomic_load_explicit(&helper_threads[id].nodes, memory_order_relaxed);
     
-    // node (position) fails low
-    return alpha;
+    // return total nodes
+    return total;
 }
 
-// search position for the best move
-void search_position(int depth)
+// let main thread know nodes searched by the current helper thread so far
+void publish_nodes()
 {
-    // search start time
-    int start = get_time_ms();
+    atomic_store_explicit(&helper_threads[thread_id].nodes, nodes, memory_order_relaxed);
+}
 
+// iterative deepening loop of a search thread
+void iterative_deepening(int depth, int start)
+{
     // define best score variable
     int score = 0;
     
     // reset nodes counter
     nodes = 0;
     
-    // reset "time is up" flag
-    stopped = 0;
+    // reset evaluation cache counters
+    eval_cache_probes = eval_cache_hits = 0;
+    
+    // reset lazy evaluation counters
+    lazy_eval_skips = 0;
+    lazy_error_sum = lazy_error_count = 0;
     
-    // reset follow PV flags
+    // reset follow PV flag
     follow_pv = 0;
-    score_pv = 0;
     
     // clear helper data structures for search
     memset(killer_moves, 0, sizeof(killer_moves));
@@ -4301,8 +6315,8 @@ void search_position(int depth)
     int alpha = -infinity;
     int beta = infinity;
  
-    // iterative deepening
-    for (int current_depth = 1; current_depth <= depth; current_depth++)
+    // iterative deepening (odd helper threads start one ply deeper)
+    for (int current_depth = 1 + thread_id % 2; current_depth <= depth; current_depth++)
     {
         // if time is up
         if(stopped == 1)
@@ -4326,18 +6340,25 @@ void search_position(int depth)
         alpha = score - 50;
         beta = score + 50;
         
-        // if PV is available
-        if (pv_length[0])
+        // keep moves of the completed iteration (interrupted one leaves PV incomplete)
+        if (pv_length[0] && thread_id == 0 && stopped == 0)
+        {
+            search_best_move = pv_table[0][0];
+            search_ponder_move = pv_length[0] > 1 ? pv_table[0][1] : 0;
+        }
+        
+        // if PV is available and current thread is talking to the GUI
+        if (pv_length[0] && thread_id == 0)
         {
             // print search info
             if (score > -mate_value && score < -mate_score)
-                printf("info score mate %d depth %d nodes %lld time %d pv ", -(score + mate_value) / 2 - 1, current_depth, nodes, get_time_ms() - start);
+                printf("info score mate %d depth %d nodes %lld time %d pv ", -(score + mate_value) / 2 - 1, current_depth, total_nodes(), get_time_ms() - start);
             
             else if (score > mate_score && score < mate_value)
-                printf("info score mate %d depth %d nodes %lld time %d pv ", (mate_value - score) / 2 + 1, current_depth, nodes, get_time_ms() - start);   
+                printf("info score mate %d depth %d nodes %lld time %d pv ", (mate_value - score) / 2 + 1, current_depth, total_nodes(), get_time_ms() - start);   
             
             else
-                printf("info score cp %d depth %d nodes %lld time %d pv ", score, current_depth, nodes, get_time_ms() - start);
+                printf("info score cp %d depth %d nodes %lld time %d pv ", score, current_depth, total_nodes(), get_time_ms() - start);
             
             // loop over the moves within a PV line
             for (int count = 0; count < pv_length[0]; count++)
@@ -4351,13 +6372,236 @@ void search_position(int depth)
             printf("\n");
         }
     }
+}
+
+// helper thread entry point
+void *helper_search(void *arg)
+{
+    // init search thread data
+    search_thread *helper = (search_thread *)arg;
+    
+    // init thread index
+    thread_id = helper->id;
+    
+    // set up root position
+    load_position(&root_position);
+    
+    // search root position until main thread is done
+    iterative_deepening(helper->depth, 0);
+    
+    // publish final node count
+    publish_nodes();
+    
+    // keep evaluation cache counters as well
+    helper->eval_probes = eval_cache_probes;
+    helper->eval_hits = eval_cache_hits;
+    helper->lazy_skips = lazy_eval_skips;
+    
+    return NULL;
+}
+
+// search position for the best move
+void search_position(int depth)
+{
+    // search start time
+    int start = get_time_ms();
+    
+    // no iteration is completed yet
+    search_best_move = search_ponder_move = 0;
+    
+    // entries written from now on belong to the new search
+    hash_age = (hash_age + 1) & 0x3f;
+    
+    // share root position with helper threads
+    save_position(&root_position);
+    
+    // loop over helper threads
+    for (int id = 1; id < threads; id++)
+    {
+        // init helper thread data
+        helper_threads[id].id = id;
+        helper_threads[id].depth = depth;
+        helper_threads[id].nodes = 0;
+        
+        // start helper thread
+        pthread_create(&helper_threads[id].handle, NULL, helper_search, &helper_threads[id]);
+    }
+    
+    // search position in the main thread
+    iterative_deepening(depth, start);
+    
+    // search is done before the opponent has moved
+    wait_ponderhit();
+    
+    // tell helper threads to stop
+    stopped = 1;
+    
+    // wait for the helper threads to finish
+    for (int id = 1; id < threads; id++)
+        pthread_join(helper_threads[id].handle, NULL);
+    
+    // init evaluation cache counters with main thread's ones
+    search_eval_probes = eval_cache_probes;
+    search_eval_hits = eval_cache_hits;
+    search_lazy_skips = lazy_eval_skips;
+    
+    // add helper threads' evaluation counters
+    for (int id = 1; id < threads; id++)
+    {
+        search_eval_probes += helper_threads[id].eval_probes;
+        search_eval_hits += helper_threads[id].eval_hits;
+        search_lazy_skips += helper_threads[id].lazy_skips;
+    }
+    
+    // print evaluation cache hit rate
+    printf("info string eval cache hits %llu of %llu probes (%llu%%)\n", search_eval_hits, search_eval_probes,
+                                                                         search_eval_probes ? search_eval_hits * 100 / search_eval_probes : 0);
+    
+    // print evaluations skipped by lazy evaluation
+    printf("info string lazy eval skipped %llu of %llu evaluations (%llu%%)\n", search_lazy_skips, search_lazy_skips + search_eval_probes,
+                                                                               search_lazy_skips ? search_lazy_skips * 100 / (search_lazy_skips + search_eval_probes) : 0);
 
-    // print best move
+    // print best move (stopped before the first iteration is done, take whatever is there)
     printf("bestmove ");
-    print_move(pv_table[0][0]);
+    print_move(search_best_move ? search_best_move : pv_table[0][0]);
+    
+    // print expected reply to ponder on
+    if (search_ponder_move)
+    {
+        printf(" ponder ");
+        print_move(search_ponder_move);
+    }
+    
     printf("\n");
 }
 
+
+/**********************************\
+ ==================================
+ 
+             Benchmark
+ 
+ ==================================
+\**********************************/
+
+// default benchmark search depth
+#define bench_depth 5
+
+// benchmark positions
+const char *bench_positions[] = {
+    start_position,
+    tricky_position,
+    killer_position,
+    cmk_position,
+    repetitions,
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1"
+};
+
+// search benchmark positions to a fixed depth and report nodes & speed
+void bench(int depth, int thread_count, int hash_mb)
+{
+    // number of benchmark positions
+    int position_count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+    
+    // total nodes searched
+    U64 total = 0;
+    
+    // total evaluation cache probes & hits
+    U64 eval_probes = 0, eval_hits = 0;
+    
+    // total evaluations skipped by lazy evaluation
+    U64 lazy_skips = 0;
+    
+    // set number of search threads
+    threads = thread_count;
+    
+    // init hash table
+    init_hash_table(hash_mb);
+    
+    // init start time
+    int start = get_time_ms();
+    
+    // loop over benchmark positions
+    for (int index = 0; index < position_count; index++)
+    {
+        printf("\nPosition: %d/%d %s\n", index + 1, position_count, bench_positions[index]);
+        
+        // init position
+        parse_fen((char *)bench_positions[index]);
+        
+        // every position is searched from scratch
+        clear_hash_table();
+        clear_eval_cache();
+        
+        // search without time limit (GUI can't stop benchmark)
+        timeset = 0;
+        stopped = 0;
+        search_position(depth);
+        
+        // add up nodes searched by all threads
+        total += total_nodes();
+        
+        // add up evaluation cache counters
+        eval_probes += search_eval_probes;
+        eval_hits += search_eval_hits;
+        lazy_skips += search_lazy_skips;
+    }
+    
+    // init elapsed time (avoid division by zero)
+    int elapsed = get_time_ms() - start;
+    if (elapsed < 1) elapsed = 1;
+    
+    // print results (node signature is deterministic with a single thread only)
+    printf("\n===========================\n");
+    printf("Depth             : %d\n", depth);
+    printf("Threads           : %d\n", thread_count);
+    printf("Hash (MB)         : %d\n", hash_mb);
+    printf("Slider attacks    : %s\n", slider_backends[slider_backend]);
+    printf("Total time (ms)   : %d\n", elapsed);
+    printf("Nodes searched    : %llu\n", total);
+    printf("Nodes/second      : %llu\n", total * 1000 / elapsed);
+    printf("Eval cache hits   : %llu%%\n", eval_probes ? eval_hits * 100 / eval_probes : 0);
+    printf("Lazy eval skips   : %llu (%llu%%)\n", lazy_skips, lazy_skips ? lazy_skips * 100 / (lazy_skips + eval_probes) : 0);
+    printf("Signature         : %llu\n", total);
+}
+
+
 /**********************************\
  ==================================
  
@@ -4375,7 +6619,7 @@ int parse_move(char *move_string)
     moves move_list[1];
     
     // generate moves
-    generate_moves(move_list);
+    generate_moves(move_list, generate_all);
     
     // parse source square
     int source_square = (move_string[0] - 'a') + (8 - (move_string[1] - '0')) * 8;
@@ -4487,13 +6731,7 @@ void parse_position(char *command)
                 // break out of the loop
                 break;
             
-            // increment repetition index
-            repetition_index++;
-            
-            // wtire hash key into a repetition table
-            repetition_table[repetition_index] = hash_key;
-            
-            // make move on the chess board
+            // make move on the chess board (pushes hash key onto the undo stack)
             make_move(move, all_moves);
             
             // move current character mointer to the end of current move
@@ -4512,15 +6750,14 @@ void parse_position(char *command)
 void reset_time_control()
 {
     // reset timing
-    quit = 0;
     movestogo = 30;
     movetime = -1;
-    time = -1;
+    uci_time = -1;
     inc = 0;
     starttime = 0;
     stoptime = 0;
     timeset = 0;
-    stopped = 0;
+    pondering = 0;
 }
 
 // parse UCI command "go"
@@ -4538,6 +6775,11 @@ void parse_go(char *command)
     // infinite search
     if ((argument = strstr(command,"infinite"))) {}
 
+    // match UCI "ponder" command
+    if ((argument = strstr(command,"ponder")))
+        // search on opponent's time until "ponderhit" or "stop"
+        pondering = 1;
+
     // match UCI "binc" command
     if ((argument = strstr(command,"binc")) && side == black)
         // parse black time increment
@@ -4551,12 +6793,12 @@ void parse_go(char *command)
     // match UCI "wtime" command
     if ((argument = strstr(command,"wtime")) && side == white)
         // parse white time limit
-        time = atoi(argument + 6);
+        uci_time = atoi(argument + 6);
 
     // match UCI "btime" command
     if ((argument = strstr(command,"btime")) && side == black)
         // parse black time limit
-        time = atoi(argument + 6);
+        uci_time = atoi(argument + 6);
 
     // match UCI "movestogo" command
     if ((argument = strstr(command,"movestogo")))
@@ -4577,7 +6819,7 @@ void parse_go(char *command)
     if(movetime != -1)
     {
         // set time equal to move time
-        time = movetime;
+        uci_time = movetime;
 
         // set moves to go to 1
         movestogo = 1;
@@ -4590,22 +6832,22 @@ void parse_go(char *command)
     depth = depth;
 
     // if time control is available
-    if(time != -1)
+    if(uci_time != -1)
     {
         // flag we're playing with time control
         timeset = 1;
 
         // set up timing
-        time /= movestogo;
+        uci_time /= movestogo;
         
         // disable time buffer when time is almost up
-        if (time > 1500) time -= 50;
+        if (uci_time > 1500) uci_time -= 50;
         
         // init stoptime
-        stoptime = starttime + time + inc;
+        stoptime = starttime + uci_time + inc;
         
         // treat increment as seconds per move when time is almost up
-        if (time < 1500 && inc && depth == 64) stoptime = starttime + inc - 50;
+        if (uci_time < 1500 && inc && depth == 64) stoptime = starttime + inc - 50;
     }
 
     // if depth is not available
@@ -4615,10 +6857,16 @@ void parse_go(char *command)
 
     // print debug info
     printf("time: %d  start: %u  stop: %u  depth: %d  timeset:%d\n",
-            time, starttime, stoptime, depth, timeset);
+            uci_time, starttime, stoptime, depth, timeset);
 
+    // let input thread handle "stop" while searching
+    set_searching(1);
+    
     // search position
     search_position(depth);
+    
+    // UCI loop takes over input handling again
+    set_searching(0);
 }
 
 // main UCI loop
@@ -4627,20 +6875,35 @@ void uci_loop()
     // max hash MB
     int max_hash = 128;
     
+    // number of threads
+    int thread_count = 1;
+    
     // default MB value
     int mb = 64;
 
-    // reset STDIN & STDOUT buffers
-    setbuf(stdin, NULL);
+    // reset STDOUT buffer
     setbuf(stdout, NULL);
     
     // define user / GUI input buffer
-    char input[2000];
+    char input[input_size];
+    
+    // start reading user / GUI input
+    pthread_t input_handle;
+    pthread_create(&input_handle, NULL, read_input, NULL);
+    pthread_detach(input_handle);
     
     // print engine info
     printf("id name BBC %s\n", version);
     printf("id author Code Monkey King\n");
     printf("option name Hash type spin default 64 min 4 max %d\n", max_hash);
+    printf("option name Threads type spin default 1 min 1 max %d\n", max_threads);
+    printf("option name EvalFile type string default %s\n", nnue_file);
+    printf("option name EndgameEvalFile type string default <empty>\n");
+    printf("option name EndgameNetPhase type spin default 3500 min 0 max %d\n", opening_phase_score);
+    printf("option name LazyMargin type spin default 400 min 0 max %d\n", infinity);
+    printf("option name LazyMarginNNUE type spin default -1 min -1 max %d\n", infinity);
+    printf("option name SliderAttacks type combo default %s var magic%s\n", slider_backends[slider_backend], pext_supported() ? " var pext" : "");
+    printf("option name Ponder type check default false\n");
     printf("uciok\n");
     
     // main loop
@@ -4653,9 +6916,7 @@ void uci_loop()
         fflush(stdout);
         
         // get user / GUI input
-        if (!fgets(input, 2000, stdin))
-            // continue the loop
-            continue;
+        get_input(input);
         
         // make sure input is available
         if (input[0] == '\n')
@@ -4674,9 +6935,6 @@ void uci_loop()
         {
             // call parse position function
             parse_position(input);
-        
-            // clear hash table
-            clear_hash_table();
         }
         // parse UCI "ucinewgame" command
         else if (strncmp(input, "ucinewgame", 10) == 0)
@@ -4686,6 +6944,9 @@ void uci_loop()
             
             // clear hash table
             clear_hash_table();
+            
+            // clear evaluation cache
+            clear_eval_cache();
         }
         // parse UCI "go" command
         else if (strncmp(input, "go", 2) == 0)
@@ -4703,6 +6964,15 @@ void uci_loop()
             // print engine info
             printf("id name BBC %s\n", version);
             printf("id author Code Monkey King\n");
+            printf("option name Hash type spin default 64 min 4 max %d\n", max_hash);
+            printf("option name Threads type spin default 1 min 1 max %d\n", max_threads);
+            printf("option name EvalFile type string default %s\n", nnue_file);
+            printf("option name EndgameEvalFile type string default <empty>\n");
+            printf("option name EndgameNetPhase type spin default 3500 min 0 max %d\n", opening_phase_score);
+            printf("option name LazyMargin type spin default 400 min 0 max %d\n", infinity);
+            printf("option name LazyMarginNNUE type spin default -1 min -1 max %d\n", infinity);
+            printf("option name SliderAttacks type combo default %s var magic%s\n", slider_backends[slider_backend], pext_supported() ? " var pext" : "");
+            printf("option name Ponder type check default false\n");
             printf("uciok\n");
         }
         
@@ -4718,6 +6988,102 @@ void uci_loop()
             printf("    Set hash table size to %dMB\n", mb);
             init_hash_table(mb);
         }
+        
+        // parse "perft [depth]" and "divide [depth]" commands
+        else if (strncmp(input, "perft", 5) == 0 || strncmp(input, "divide", 6) == 0)
+        {
+            // init perft depth
+            int depth = 1;
+            sscanf(input, "%*s %d", &depth);
+            
+            // run perft using the "Threads" and "Hash" option values
+            perft_test(depth, input[0] == 'd', thread_count, mb);
+        }
+        
+        // parse "bench [depth] [threads] [hash]" command
+        else if (strncmp(input, "bench", 5) == 0)
+        {
+            // init benchmark parameters
+            int depth = bench_depth, bench_threads = 1, bench_hash = 16;
+            sscanf(input, "%*s %d %d %d", &depth, &bench_threads, &bench_hash);
+            
+            // run benchmark
+            bench(depth, bench_threads, bench_hash);
+            
+            // restore engine settings
+            threads = thread_count;
+            init_hash_table(mb);
+        }
+        
+        else if (!strncmp(input, "setoption name Threads value ", 29)) {
+            // init number of threads
+            sscanf(input,"%*s %*s %*s %*s %d", &thread_count);
+            
+            // adjust number of threads if going beyond the allowed bounds
+            if(thread_count < 1) thread_count = 1;
+            if(thread_count > max_threads) thread_count = max_threads;
+            
+            // set number of search threads
+            printf("    Set number of threads to %d\n", thread_count);
+            threads = thread_count;
+        }
+        
+        // parse NNUE network file options
+        else if (!strncmp(input, "setoption name EvalFile value ", 30) ||
+                 !strncmp(input, "setoption name EndgameEvalFile value ", 37))
+        {
+            // init network the option belongs to
+            int net = strncmp(input, "setoption name EvalFile", 23) ? endgame_net : main_net;
+            
+            // init file name (the rest of the line)
+            char *file = strstr(input, " value ") + 7;
+            file[strcspn(file, "\r\n")] = 0;
+            
+            // "<empty>" means no network
+            if (!strcmp(file, "<empty>")) file[0] = 0;
+            
+            // set network file
+            snprintf(nnue_files[net], sizeof(nnue_files[net]), "%s", file);
+            
+            // reload networks
+            load_nnue_networks();
+            
+            // cached scores may come from another network
+            clear_eval_cache();
+            
+            // report networks in use
+            print_nnue_networks();
+        }
+        
+        // parse endgame network phase option
+        else if (!strncmp(input, "setoption name EndgameNetPhase value ", 37))
+        {
+            // init phase score
+            sscanf(input, "%*s %*s %*s %*s %d", &endgame_net_phase);
+            
+            // cached scores may come from another network
+            clear_eval_cache();
+            
+            // report networks in use
+            print_nnue_networks();
+        }
+        
+        // parse lazy evaluation margin option
+        else if (!strncmp(input, "setoption name LazyMargin value ", 32))
+            // init lazy evaluation margin
+            sscanf(input, "%*s %*s %*s %*s %d", &lazy_margin);
+        
+        // parse NNUE lazy evaluation margin option
+        else if (!strncmp(input, "setoption name LazyMarginNNUE value ", 36))
+            // init NNUE lazy evaluation margin
+            sscanf(input, "%*s %*s %*s %*s %d", &lazy_margin_nnue);
+        
+        // parse slider attacks backend option
+        else if (!strncmp(input, "setoption name SliderAttacks value ", 35))
+        {
+            // PEXT can only be used if CPU supports it
+            set_slider_backend((!strncmp(input + 35, "pext", 4) && pext_supported()) ? pext_backend : magic_backend);
+        }
     }
 }
 
@@ -4730,27 +7096,112 @@ void uci_loop()
  ==================================
 \**********************************/
 
-// init all variables
-void init_all()
+// init attack tables & evaluation masks (compiled in with precomputed tables)
+void init_tables(int backend)
 {
+#ifndef PRECOMPUTED_TABLES
     // init leaper pieces attacks
     init_leapers_attacks();
     
-    // init slider pieces attacks
-    init_sliders_attacks(bishop);
-    init_sliders_attacks(rook);
+    // init slider pieces attacks of the given backend
+    init_sliders_attacks(bishop, backend);
+    init_sliders_attacks(rook, backend);
     
-    // init random keys for hashing purposes
-    init_random_keys();
+    // init squares between aligned squares
+    init_between_masks();
     
     // init evaluation masks
     init_evaluation_masks();
+#endif
+}
+
+// print table as C array definition
+void print_table(char *declaration, const U64 *table, int size)
+{
+    // print declaration
+    printf("const U64 %s = {", declaration);
+    
+    // print table entries 4 per line
+    for (int index = 0; index < size; index++)
+        printf("%s0x%llxULL%s", index % 4 ? " " : "\n    ", table[index], index < size - 1 ? "," : "");
+    
+    // close definition
+    printf("\n};\n\n");
+}
+
+// print offsets table as C array definition
+void print_offsets(char *declaration, const int *table)
+{
+    // print declaration
+    printf("const int %s = {", declaration);
+    
+    // print offsets 8 per line
+    for (int square = 0; square < 64; square++)
+        printf("%s%d%s", square % 8 ? " " : "\n    ", table[square], square < 63 ? "," : "");
+    
+    // close definition
+    printf("\n};\n\n");
+}
+
+// print magic numbers, attack tables & evaluation masks as C source (makefile's tables.h target)
+void print_tables()
+{
+    printf("// generated by \"bbc tables\", do not edit\n\n");
+    
+    // magic numbers
+    print_table("rook_magic_numbers[64]", rook_magic_numbers, 64);
+    print_table("bishop_magic_numbers[64]", bishop_magic_numbers, 64);
+    
+    // leaper attacks
+    print_table("pawn_attacks[2][64]", &pawn_attacks[0][0], 2 * 64);
+    print_table("knight_attacks[64]", knight_attacks, 64);
+    print_table("king_attacks[64]", king_attacks, 64);
+    
+    // slider attacks
+    print_table("bishop_masks[64]", bishop_masks, 64);
+    print_table("rook_masks[64]", rook_masks, 64);
+    print_offsets("bishop_offsets[64]", bishop_offsets);
+    print_offsets("rook_offsets[64]", rook_offsets);
+    print_table("slider_attacks[5248 + 102400]", slider_attacks, 5248 + 102400);
+    
+    #ifdef USE_PEXT
+    // compiled in only if the engine uses PEXT as well
+    printf("#ifdef USE_PEXT\n");
+    print_table("pext_attacks[5248 + 102400]", pext_attacks, 5248 + 102400);
+    printf("#endif\n\n");
+    #endif
+    
+    print_table("between_masks[64][64]", &between_masks[0][0], 64 * 64);
+    
+    // evaluation masks
+    print_table("file_masks[64]", file_masks, 64);
+    print_table("rank_masks[64]", rank_masks, 64);
+    print_table("isolated_masks[64]", isolated_masks, 64);
+    print_table("white_passed_masks[64]", white_passed_masks, 64);
+    print_table("black_passed_masks[64]", black_passed_masks, 64);
+}
+
+// init all variables
+void init_all()
+{
+    // use PEXT slider attacks where they're fast
+    slider_backend = pext_fast() ? pext_backend : magic_backend;
+    printf("info string slider attacks using %s\n", slider_backends[slider_backend]);
+    
+    // init attack tables & evaluation masks
+    init_tables(slider_backend);
+    
+    // init random keys for hashing purposes
+    init_random_keys();
+    
+    // init material & piece-square score and game phase score tables
+    init_psq_table();
     
     // init hash table with default 64 MB
     init_hash_table(64);
     
     // init NNUE weights
-    init_nnue("nn-04cf2b4ed1da.nnue");
+    load_nnue_networks();
 }
 
 
@@ -4762,81 +7213,55 @@ void init_all()
  ==================================
 \**********************************/
 
-// init NNUE input
-static inline void nnue_input(int *pieces, int *squares)
+int main(int argc, char *argv[])
 {
-    U64 bitboard;
-    int piece, square;
-    int index = 2;
-
-    // loop over piece bitboards
-    for (int bb_piece = P; bb_piece <= k; bb_piece++)
+    // print tables to precompute from command line: bbc tables > tables.h
+    if (argc > 1 && strcmp(argv[1], "tables") == 0)
     {
-        // init piece bitboard copy
-        bitboard = bitboards[bb_piece];
+        // init tables of all the slider attacks backends
+        init_tables(all_backends);
         
-        // loop over pieces within a bitboard
-        while (bitboard)
-        {
-            // init piece
-            piece = bb_piece;
-            
-            // init square
-            square = get_ls1b_index(bitboard);
-            
-            //printf("piece: %c  piece code: %d  square index: %d  square: %s\n", ascii_pieces[piece], piece, square, square_to_coordinates[square]);
-            
-            if (piece == K)
-            {
-                /* convert white king piece code to stockfish piece code and
-                   store it at the first index of pieces array
-                */ 
-                pieces[0] = nnue_pieces[piece];
-                
-                /* convert white king square index to stockfish square index and
-                   store it at the first index of pieces array
-                */
-                squares[0] = nnue_squares[square];
-            }
-            
-            else if (piece == k)
-            {
-                /* convert black king piece code to stockfish piece code and
-                   store it at the second index of pieces array
-                */
-                pieces[1] = nnue_pieces[piece];
-                
-                /* convert black king square index to stockfish square index and
-                   store it at the second index of pieces array
-                */
-                squares[1] = nnue_squares[square];
-            }
-            
-            else
-            {
-                /*  convert all the rest of piece code with corresponding square codes
-                    to stockfish piece codes and square indicies respectively
-                */
-                pieces[index] = nnue_pieces[piece];
-                squares[index] = nnue_squares[square];
-                index++;    
-            }
-            
-            // pop LS1B
-            pop_bit(bitboard, square);
-        }
+        // print them
+        print_tables();
+        
+        return 0;
     }
     
-    // end arrays with sero terminating character
-    pieces[index] = 0;
-    squares[index] = 0;
-}
-
-int main()
-{
     // init all
     init_all();
     
+    // run benchmark from command line: bbc bench [depth] [threads] [hash]
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        // run benchmark
+        bench(argc > 2 ? atoi(argv[2]) : bench_depth,
+              argc > 3 ? atoi(argv[3]) : 1,
+              argc > 4 ? atoi(argv[4]) : 16);
+        
+        // free hash table memory on exit
+        free(hash_table);
+        
+        return 0;
+    }
+    
+    // run perft from command line: bbc perft|divide [depth] [threads] [hash]
+    if (argc > 1 && (strcmp(argv[1], "perft") == 0 || strcmp(argv[1], "divide") == 0))
+    {
+        // init start position
+        parse_fen(start_position);
+        
+        // run perft
+        perft_test(argc > 2 ? atoi(argv[2]) : 1,
+                   argv[1][0] == 'd',
+                   argc > 3 ? atoi(argv[3]) : 1,
+                   argc > 4 ? atoi(argv[4]) : 64);
+        
+        // free hash table memory on exit
+        free(hash_table);
+        
+        return 0;
+    }
+    
     // connect to GUI
     uci_loop();
     
@@ -0,0 +1,38 @@
+#ifndef INCBIN_H
+#define INCBIN_H
+
+/**
+* Minimal file embedding for GCC/Clang on ELF and PE targets.
+* INCBIN(Name, "file") defines gNameData (64 byte aligned), gNameEnd and
+* gNameSize in the translation unit it's used in, INCBIN_EXTERN(Name)
+* declares them anywhere else. The file is looked up relative to the
+* working directory and the -I paths of the build.
+*/
+#ifdef __cplusplus
+#   define INCBIN_EXTERNC extern "C"
+#else
+#   define INCBIN_EXTERNC extern
+#endif
+
+#define INCBIN_EXTERN(NAME) \
+  INCBIN_EXTERNC const unsigned char g##NAME##Data[]; \
+  INCBIN_EXTERNC const unsigned char g##NAME##End[]; \
+  INCBIN_EXTERNC const unsigned int g##NAME##Size
+
+#define INCBIN(NAME, FILENAME) \
+  __asm__(".section .rodata\n" \
+          ".global g" #NAME "Data\n" \
+          ".balign 64\n" \
+          "g" #NAME "Data:\n" \
+          ".incbin \"" FILENAME "\"\n" \
+          ".global g" #NAME "End\n" \
+          "g" #NAME "End:\n" \
+          ".byte 0\n" \
+          ".balign 4\n" \
+          ".global g" #NAME "Size\n" \
+          "g" #NAME "Size:\n" \
+          ".int g" #NAME "End - g" #NAME "Data\n" \
+          ".text\n"); \
+  INCBIN_EXTERN(NAME)
+
+#endif
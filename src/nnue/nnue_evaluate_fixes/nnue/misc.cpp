@@ -7,6 +7,12 @@
 
 #include "misc.h"
 
+// The net is embedded once here rather than in every SIMD build of nnue.cpp
+#ifdef NNUE_EMBEDDED
+#include "incbin.h"
+INCBIN(Network, DefaultEvalFile);
+#endif
+
 FD open_file(const char *name)
 {
 #ifndef _WIN32
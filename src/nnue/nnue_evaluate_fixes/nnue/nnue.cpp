@@ -26,13 +26,38 @@
 #include <arm_neon.h>
 #endif
 
+// When built for runtime dispatch this file is compiled once per SIMD
+// level with NNUE_ARCH set, so every copy gets suffixed exported names
+// (nnue_init_avx2 etc.). nnue_dispatch.cpp then provides the real ones.
+#ifdef NNUE_ARCH
+#define NNUE_SUFFIX2(name, arch) name##_##arch
+#define NNUE_SUFFIX(name, arch) NNUE_SUFFIX2(name, arch)
+#define nnue_init NNUE_SUFFIX(nnue_init, NNUE_ARCH)
+#define nnue_evaluate NNUE_SUFFIX(nnue_evaluate, NNUE_ARCH)
+#define nnue_evaluate_pos NNUE_SUFFIX(nnue_evaluate_pos, NNUE_ARCH)
+#define nnue_evaluate_fen NNUE_SUFFIX(nnue_evaluate_fen, NNUE_ARCH)
+#define nnue_evaluate_fen_batch NNUE_SUFFIX(nnue_evaluate_fen_batch, NNUE_ARCH)
+#define nnue_evaluate_incremental NNUE_SUFFIX(nnue_evaluate_incremental, NNUE_ARCH)
+#define nnue_update_accumulator NNUE_SUFFIX(nnue_update_accumulator, NNUE_ARCH)
+#define nnue_load NNUE_SUFFIX(nnue_load, NNUE_ARCH)
+#define nnue_select NNUE_SUFFIX(nnue_select, NNUE_ARCH)
+#define PieceToIndex NNUE_SUFFIX(PieceToIndex, NNUE_ARCH)
+#endif
+
 #define DLL_EXPORT
 #include "nnue.h"
 #undef DLL_EXPORT
 
 #ifdef NNUE_EMBEDDED
 #include "incbin.h"
-INCBIN(Network, DefaultEvalFile);
+INCBIN_EXTERN(Network);
+#endif
+
+#if defined(NNUE_SHARED) && !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 // Old gcc on Windows is unable to provide a 32-byte aligned stack.
@@ -183,6 +208,15 @@ typedef struct {
   unsigned values[30];
 } IndexList;
 
+// Network used by the current thread (see nnue_select())
+static thread_local int net_index = 0;
+
+// Accumulator was computed with the network of the current thread
+INLINE bool accumulator_ready(const Accumulator *accumulator)
+{
+  return accumulator->computedAccumulation && accumulator->net == net_index;
+}
+
 INLINE int orient(int c, int s)
 {
   return s ^ (c == white ? 0x00 : 0x3f);
@@ -193,19 +227,6 @@ INLINE unsigned make_index(int c, int s, int pc, int ksq)
   return orient(c, s) + PieceToIndex[c][pc] + PS_END * ksq;
 }
 
-static void half_kp_append_active_indices(const Position *pos, const int c,
-    IndexList *active)
-{
-  int ksq = pos->squares[c ? 1 : 0];
-  ksq = orient(c, ksq);
-  for (int i = 2; pos->pieces[i]; i++) {
-    int sq = pos->squares[i];
-    int pc = pos->pieces[i];
-    active->values[active->size++] = make_index(c, sq, pc, ksq);
-  }
-}
-
-#if 0
 static void half_kp_append_changed_indices(const Position *pos, const int c,
     const DirtyPiece *dp, IndexList *removed, IndexList *added)
 {
@@ -220,44 +241,30 @@ static void half_kp_append_changed_indices(const Position *pos, const int c,
       added->values[added->size++] = make_index(c, dp->to[i], pc, ksq);
   }
 }
-#endif
 
-static void append_active_indices(const Position *pos, IndexList active[2])
-{
-  for (unsigned c = 0; c < 2; c++)
-    half_kp_append_active_indices(pos, c, &active[c]);
-}
-
-#if 0
 static void append_changed_indices(const Position *pos, IndexList removed[2],
     IndexList added[2], bool reset[2])
 {
-  const DirtyPiece *dp = &(pos->hstack[pos->hply].dirtyPiece);
-  assert(dp->dirtyNum != 0);
+  const DirtyPiece *dp = &(pos->nnue[0]->dirtyPiece);
 
-  if (pos->hstack[pos->hply-1].accumulator.computedAccumulation) {
+  if (accumulator_ready(&pos->nnue[1]->accumulator)) {
     for (unsigned c = 0; c < 2; c++) {
       reset[c] = dp->pc[0] == (int)COMBINE(c, king);
-      if (reset[c])
-        half_kp_append_active_indices(pos, c, &added[c]);
-      else
+      if (!reset[c])
         half_kp_append_changed_indices(pos, c, dp, &removed[c], &added[c]);
     }
   } else {
-    const DirtyPiece *dp2 = &(pos->hstack[pos->hply-1].dirtyPiece);
+    const DirtyPiece *dp2 = &(pos->nnue[1]->dirtyPiece);
     for (unsigned c = 0; c < 2; c++) {
       reset[c] =   dp->pc[0] == (int)COMBINE(c, king)
                 || dp2->pc[0] == (int)COMBINE(c, king);
-      if (reset[c])
-        half_kp_append_active_indices(pos, c, &added[c]);
-      else {
+      if (!reset[c]) {
         half_kp_append_changed_indices(pos, c, dp, &removed[c], &added[c]);
         half_kp_append_changed_indices(pos, c, dp2, &removed[c], &added[c]);
       }
     }
   }
 }
-#endif
 
 // InputLayer = InputSlice<256 * 2>
 // out: 512 x clipped_t
@@ -271,18 +278,42 @@ static void append_changed_indices(const Position *pos, IndexList removed[2],
 // OutputLayer = AffineTransform<HiddenLayer2, 1>
 // 32 x clipped_t -> 1 x int32_t
 
+// All the weights in the layout the kernels use, kept in one block so
+// that it can live in a mapping shared by several processes
+typedef struct {
+  // Input feature converter
+  int16_t ft_biases alignas(64) [kHalfDimensions];
+  int16_t ft_weights alignas(64) [kHalfDimensions * FtInDims];
+
 #if !defined(USE_AVX512)
-static weight_t hidden1_weights alignas(64) [32 * 512];
-static weight_t hidden2_weights alignas(64) [32 * 32];
+  weight_t hidden1_weights alignas(64) [32 * 512];
+  weight_t hidden2_weights alignas(64) [32 * 32];
 #else
-static weight_t hidden1_weights alignas(64) [64 * 512];
-static weight_t hidden2_weights alignas(64) [64 * 32];
+  weight_t hidden1_weights alignas(64) [64 * 512];
+  weight_t hidden2_weights alignas(64) [64 * 32];
 #endif
-static weight_t output_weights alignas(64) [1 * 32];
+  weight_t output_weights alignas(64) [1 * 32];
+
+  int32_t hidden1_biases alignas(64) [32];
+  int32_t hidden2_biases alignas(64) [32];
+  int32_t output_biases[1];
+
+  uint32_t ready;   // set once the weights are laid out (shared mapping)
+} NetWeights;
 
-static int32_t hidden1_biases alignas(64) [32];
-static int32_t hidden2_biases alignas(64) [32];
-static int32_t output_biases[1];
+static NetWeights net_storage[NNUE_MAX_NETS];
+static NetWeights *nets[NNUE_MAX_NETS] = { &net_storage[0], &net_storage[1] };
+
+// Weights of the network used by the current thread, resolved on every use
+// so threads never see weights another thread has moved (shared mapping)
+#define ft_biases (nets[net_index]->ft_biases)
+#define ft_weights (nets[net_index]->ft_weights)
+#define hidden1_weights (nets[net_index]->hidden1_weights)
+#define hidden2_weights (nets[net_index]->hidden2_weights)
+#define output_weights (nets[net_index]->output_weights)
+#define hidden1_biases (nets[net_index]->hidden1_biases)
+#define hidden2_biases (nets[net_index]->hidden2_biases)
+#define output_biases (nets[net_index]->output_biases)
 
 INLINE int32_t affine_propagate(clipped_t *input, int32_t *biases,
     weight_t *weights)
@@ -875,73 +906,133 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
 }
 #endif
 
-// Input feature converter
-static int16_t ft_biases alignas(64) [kHalfDimensions];
-static int16_t ft_weights alignas(64) [kHalfDimensions * FtInDims];
-
 #ifdef VECTOR
 #define TILE_HEIGHT (NUM_REGS * SIMD_WIDTH / 16)
 #endif
 
-// Calculate cumulative value without using difference calculation
-INLINE void refresh_accumulator(Position *pos)
+// Refresh cache ("Finny tables"): for every perspective and king square
+// the accumulator of the last refresh with the king there is kept along
+// with the pieces it was computed from, so a refresh only has to apply
+// the difference between that board and the current one.
+typedef struct {
+  alignas(64) int16_t accumulation[kHalfDimensions];
+  int8_t board[64];   // piece codes (kings left out), 0 = empty
+} RefreshCacheEntry;
+
+static thread_local RefreshCacheEntry refresh_cache[NNUE_MAX_NETS][2][64];
+
+// Weights the refresh caches of the current thread were built with
+static thread_local unsigned refresh_cache_net[NNUE_MAX_NETS];
+static unsigned loaded_net[NNUE_MAX_NETS];
+
+// Set every cache entry of the current network to the accumulator of an empty board
+static void reset_refresh_cache(void)
 {
-  Accumulator *accumulator = &(pos->accumulator);
+  for (unsigned c = 0; c < 2; c++)
+    for (unsigned ksq = 0; ksq < 64; ksq++) {
+      memcpy(refresh_cache[net_index][c][ksq].accumulation, ft_biases,
+          kHalfDimensions * sizeof(int16_t));
+      memset(refresh_cache[net_index][c][ksq].board, 0, 64);
+    }
+
+  refresh_cache_net[net_index] = loaded_net[net_index];
+}
 
-  IndexList activeIndices[2];
-  activeIndices[0].size = activeIndices[1].size = 0;
-  append_active_indices(pos, activeIndices);
+// Calculate one perspective of the accumulator from the refresh cache
+static void refresh_perspective(const Position *pos, const int c,
+    int16_t *accumulation)
+{
+  if (refresh_cache_net[net_index] != loaded_net[net_index])
+    reset_refresh_cache();
+
+  int ksq = pos->squares[c ? 1 : 0];
+  RefreshCacheEntry *entry = &refresh_cache[net_index][c][ksq];
+  ksq = orient(c, ksq);
+
+  int8_t board[64] = { 0 };
+  for (int i = 2; pos->pieces[i]; i++)
+    board[pos->squares[i]] = pos->pieces[i];
+
+  IndexList removed, added;
+  removed.size = added.size = 0;
+  for (int sq = 0; sq < 64; sq++) {
+    if (entry->board[sq] == board[sq]) continue;
+    if (entry->board[sq])
+      removed.values[removed.size++] = make_index(c, sq, entry->board[sq], ksq);
+    if (board[sq])
+      added.values[added.size++] = make_index(c, sq, board[sq], ksq);
+    entry->board[sq] = board[sq];
+  }
 
-  for (unsigned c = 0; c < 2; c++) {
 #ifdef VECTOR
-    for (unsigned i = 0; i < kHalfDimensions / TILE_HEIGHT; i++) {
-      vec16_t *ft_biases_tile = (vec16_t *)&ft_biases[i * TILE_HEIGHT];
-      vec16_t *accTile = (vec16_t *)&accumulator->accumulation[c][i * TILE_HEIGHT];
-      vec16_t acc[NUM_REGS];
+  for (unsigned i = 0; i < kHalfDimensions / TILE_HEIGHT; i++) {
+    vec16_t *entryTile = (vec16_t *)&entry->accumulation[i * TILE_HEIGHT];
+    vec16_t *accTile = (vec16_t *)&accumulation[i * TILE_HEIGHT];
+    vec16_t acc[NUM_REGS];
 
-      for (unsigned j = 0; j < NUM_REGS; j++)
-        acc[j] = ft_biases_tile[j];
+    for (unsigned j = 0; j < NUM_REGS; j++)
+      acc[j] = entryTile[j];
 
-      for (size_t k = 0; k < activeIndices[c].size; k++) {
-        unsigned index = activeIndices[c].values[k];
-        unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
-        vec16_t *column = (vec16_t *)&ft_weights[offset];
+    for (size_t k = 0; k < removed.size; k++) {
+      unsigned offset = kHalfDimensions * removed.values[k] + i * TILE_HEIGHT;
+      vec16_t *column = (vec16_t *)&ft_weights[offset];
 
-        for (unsigned j = 0; j < NUM_REGS; j++)
-          acc[j] = vec_add_16(acc[j], column[j]);
-      }
+      for (unsigned j = 0; j < NUM_REGS; j++)
+        acc[j] = vec_sub_16(acc[j], column[j]);
+    }
+
+    for (size_t k = 0; k < added.size; k++) {
+      unsigned offset = kHalfDimensions * added.values[k] + i * TILE_HEIGHT;
+      vec16_t *column = (vec16_t *)&ft_weights[offset];
 
       for (unsigned j = 0; j < NUM_REGS; j++)
-        accTile[j] = acc[j];
+        acc[j] = vec_add_16(acc[j], column[j]);
     }
+
+    for (unsigned j = 0; j < NUM_REGS; j++)
+      entryTile[j] = accTile[j] = acc[j];
+  }
 #else
-    memcpy(accumulator->accumulation[c], ft_biases,
-        kHalfDimensions * sizeof(int16_t));
+  for (size_t k = 0; k < removed.size; k++) {
+    unsigned offset = kHalfDimensions * removed.values[k];
 
-    for (size_t k = 0; k < activeIndices[c].size; k++) {
-      unsigned index = activeIndices[c].values[k];
-      unsigned offset = kHalfDimensions * index;
+    for (unsigned j = 0; j < kHalfDimensions; j++)
+      entry->accumulation[j] -= ft_weights[offset + j];
+  }
 
-      for (unsigned j = 0; j < kHalfDimensions; j++)
-        accumulator->accumulation[c][j] += ft_weights[offset + j];
-    }
-#endif
+  for (size_t k = 0; k < added.size; k++) {
+    unsigned offset = kHalfDimensions * added.values[k];
+
+    for (unsigned j = 0; j < kHalfDimensions; j++)
+      entry->accumulation[j] += ft_weights[offset + j];
   }
 
+  memcpy(accumulation, entry->accumulation, kHalfDimensions * sizeof(int16_t));
+#endif
+}
+
+// Calculate cumulative value without using difference calculation
+INLINE void refresh_accumulator(Position *pos)
+{
+  Accumulator *accumulator = &(pos->nnue[0]->accumulator);
+
+  for (unsigned c = 0; c < 2; c++)
+    refresh_perspective(pos, c, accumulator->accumulation[c]);
+
   accumulator->computedAccumulation = true;
+  accumulator->net = net_index;
 }
 
-#if 0
 // Calculate cumulative value using difference calculation if possible
 INLINE bool update_accumulator(Position *pos)
 {
-  Accumulator *accumulator = &(pos->hstack[pos->hply].accumulator);
-  if (accumulator->computedAccumulation)
+  Accumulator *accumulator = &(pos->nnue[0]->accumulator);
+  if (accumulator_ready(accumulator))
     return true;
 
   Accumulator *prevAcc;
-  if (   (pos->hply < 1 || !(prevAcc = &pos->hstack[pos->hply-1].accumulator)->computedAccumulation)
-      && (pos->hply < 2 || !(prevAcc = &pos->hstack[pos->hply-2].accumulator)->computedAccumulation) )
+  if (   (!pos->nnue[1] || !accumulator_ready(prevAcc = &pos->nnue[1]->accumulator))
+      && (!pos->nnue[2] || !accumulator_ready(prevAcc = &pos->nnue[2]->accumulator)) )
     return false;
 
   IndexList removed_indices[2], added_indices[2];
@@ -950,30 +1041,31 @@ INLINE bool update_accumulator(Position *pos)
   bool reset[2];
   append_changed_indices(pos, removed_indices, added_indices, reset);
 
+  // King moved: this perspective is refreshed from the refresh cache
+  for (unsigned c = 0; c < 2; c++)
+    if (reset[c])
+      refresh_perspective(pos, c, accumulator->accumulation[c]);
+
 #ifdef VECTOR
   for (unsigned i = 0; i< kHalfDimensions / TILE_HEIGHT; i++) {
     for (unsigned c = 0; c < 2; c++) {
+      if (reset[c]) continue;
+
       vec16_t *accTile = (vec16_t *)&accumulator->accumulation[c][i * TILE_HEIGHT];
       vec16_t acc[NUM_REGS];
 
-      if (reset[c]) {
-        vec16_t *ft_b_tile = (vec16_t *)&ft_biases[i * TILE_HEIGHT];
-        for (unsigned j = 0; j < NUM_REGS; j++)
-          acc[j] = ft_b_tile[j];
-      } else {
-        vec16_t *prevAccTile = (vec16_t *)&prevAcc->accumulation[c][i * TILE_HEIGHT];
-        for (unsigned j = 0; j < NUM_REGS; j++)
-          acc[j] = prevAccTile[j];
+      vec16_t *prevAccTile = (vec16_t *)&prevAcc->accumulation[c][i * TILE_HEIGHT];
+      for (unsigned j = 0; j < NUM_REGS; j++)
+        acc[j] = prevAccTile[j];
 
-        // Difference calculation for the deactivated features
-        for (unsigned k = 0; k < removed_indices[c].size; k++) {
-          unsigned index = removed_indices[c].values[k];
-          const unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
+      // Difference calculation for the deactivated features
+      for (unsigned k = 0; k < removed_indices[c].size; k++) {
+        unsigned index = removed_indices[c].values[k];
+        const unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
 
-          vec16_t *column = (vec16_t *)&ft_weights[offset];
-          for (unsigned j = 0; j < NUM_REGS; j++)
-            acc[j] = vec_sub_16(acc[j], column[j]);
-        }
+        vec16_t *column = (vec16_t *)&ft_weights[offset];
+        for (unsigned j = 0; j < NUM_REGS; j++)
+          acc[j] = vec_sub_16(acc[j], column[j]);
       }
 
       // Difference calculation for the activated features
@@ -992,20 +1084,17 @@ INLINE bool update_accumulator(Position *pos)
   }
 #else
   for (unsigned c = 0; c < 2; c++) {
-    if (reset[c]) {
-      memcpy(accumulator->accumulation[c], ft_biases,
-          kHalfDimensions * sizeof(int16_t));
-    } else {
-      memcpy(accumulator->accumulation[c], prevAcc->accumulation[c],
-          kHalfDimensions * sizeof(int16_t));
-      // Difference calculation for the deactivated features
-      for (unsigned k = 0; k < removed_indices[c].size; k++) {
-        unsigned index = removed_indices[c].values[k];
-        const unsigned offset = kHalfDimensions * index;
+    if (reset[c]) continue;
 
-        for (unsigned j = 0; j < kHalfDimensions; j++)
-          accumulator->accumulation[c][j] -= ft_weights[offset + j];
-      }
+    memcpy(accumulator->accumulation[c], prevAcc->accumulation[c],
+        kHalfDimensions * sizeof(int16_t));
+    // Difference calculation for the deactivated features
+    for (unsigned k = 0; k < removed_indices[c].size; k++) {
+      unsigned index = removed_indices[c].values[k];
+      const unsigned offset = kHalfDimensions * index;
+
+      for (unsigned j = 0; j < kHalfDimensions; j++)
+        accumulator->accumulation[c][j] -= ft_weights[offset + j];
     }
 
     // Difference calculation for the activated features
@@ -1020,19 +1109,17 @@ INLINE bool update_accumulator(Position *pos)
 #endif
 
   accumulator->computedAccumulation = true;
+  accumulator->net = net_index;
   return true;
 }
-#endif
 
 // Convert input features
 INLINE void transform(Position *pos, clipped_t *output, mask_t *outMask)
 {
-#if 0
   if (!update_accumulator(pos))
-#endif
     refresh_accumulator(pos);
 
-  int16_t (*accumulation)[2][256] = &pos->accumulator.accumulation;
+  int16_t (*accumulation)[2][256] = &pos->nnue[0]->accumulator.accumulation;
   (void)outMask; // avoid compiler warning
 
   const int perspectives[2] = { pos->player, !pos->player };
@@ -1237,7 +1324,113 @@ static void init_weights(const void *evalData)
 #endif
 }
 
-static bool load_eval_file(const char *evalFile)
+#if defined(NNUE_SHARED) && !defined(_WIN32)
+#define NNUE_STR2(x) #x
+#define NNUE_STR(x) NNUE_STR2(x)
+#ifdef NNUE_ARCH
+#define NNUE_ARCH_NAME NNUE_STR(NNUE_ARCH)
+#else
+#define NNUE_ARCH_NAME "default"
+#endif
+
+// Shared memory object name, unique for the net and the weight layout
+static void shared_net_name(char *name, const void *evalData, size_t size)
+{
+  const uint8_t *d = (const uint8_t *)evalData;
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ d[i]) * 1099511628211ULL;
+
+  sprintf(name, "/bbc-nnue-%s-%016llx", NNUE_ARCH_NAME, (unsigned long long)hash);
+}
+
+// Map the weights another process has laid out. Waits up to a second for
+// them to be ready. NULL if they never get ready (creator died).
+static NetWeights *open_shared_net(const char *name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+
+  // Wait for the creator to size the object
+  struct stat st;
+  int wait = 0;
+  for (; wait < 100; wait++) {
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == sizeof(NetWeights))
+      break;
+    usleep(10000);
+  }
+
+  void *p = MAP_FAILED;
+  if (wait < 100)
+    p = mmap(NULL, sizeof(NetWeights), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (p == MAP_FAILED)
+    return NULL;
+
+  // Wait for the creator to lay the weights out
+  NetWeights *w = (NetWeights *)p;
+  for (; wait < 100 && !__atomic_load_n(&w->ready, __ATOMIC_ACQUIRE); wait++)
+    usleep(10000);
+
+  if (!__atomic_load_n(&w->ready, __ATOMIC_ACQUIRE)) {
+    munmap(p, sizeof(NetWeights));
+    return NULL;
+  }
+
+  return w;
+}
+
+// Map the weights laid out by another process, or lay them out for the
+// others when this is the first process to load the net. An object that
+// never gets ready was left behind by a creator that died: it's removed
+// and laid out anew. The mapping is page aligned and read-only once ready.
+// NULL on failure.
+static NetWeights *map_shared_net(const void *evalData, size_t size, int index)
+{
+  char name[64];
+  shared_net_name(name, evalData, size);
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+
+    if (fd >= 0) {
+      void *p = MAP_FAILED;
+      if (ftruncate(fd, sizeof(NetWeights)) == 0)
+        p = mmap(NULL, sizeof(NetWeights), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+
+      if (p == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+      }
+
+      // Weights are laid out through nets[index]
+      nets[index] = (NetWeights *)p;
+      init_weights(evalData);
+      __atomic_store_n(&nets[index]->ready, 1, __ATOMIC_RELEASE);
+      mprotect(p, sizeof(NetWeights), PROT_READ);
+      return (NetWeights *)p;
+    }
+
+    if (errno != EEXIST)
+      return NULL;
+
+    NetWeights *w = open_shared_net(name);
+    if (w)
+      return w;
+
+    // Stale object, remove it and try to lay the weights out ourselves
+    shm_unlink(name);
+  }
+
+  return NULL;
+}
+#endif
+
+static bool load_eval_file(const char *evalFile, int index)
 {
   const void *evalData;
   map_t mapping;
@@ -1259,8 +1452,33 @@ static bool load_eval_file(const char *evalFile)
   }
 
   bool success = verify_net(evalData, size);
-  if (success)
+  if (success) {
+    // Weights are written through nets[net_index]
+    int current = net_index;
+    net_index = index;
+
+#if defined(NNUE_SHARED) && !defined(_WIN32)
+    NetWeights *previous = nets[index];
+
+    NetWeights *shared = map_shared_net(evalData, size, index);
+    if (shared)
+      nets[index] = shared;
+    else {
+      nets[index] = &net_storage[index];
+      init_weights(evalData);
+    }
+
+    if (previous != &net_storage[index])
+      munmap(previous, sizeof(NetWeights));
+#else
     init_weights(evalData);
+#endif
+
+    net_index = current;
+
+    // Refresh caches built with the previous weights are stale now
+    loaded_net[index]++;
+  }
   if (mapping) unmap_file(evalData, mapping);
   return success;
 }
@@ -1268,32 +1486,81 @@ static bool load_eval_file(const char *evalFile)
 /*
 Interfaces
 */
-static char *loadedFile = NULL;
+static char *loadedFile[NNUE_MAX_NETS];
 
-DLLExport void _CDECL nnue_init(const char* evalFile)
+DLLExport int _CDECL nnue_load(int index, const char* evalFile)
 {
-  if (loadedFile && strcmp(evalFile, loadedFile) == 0)
-    return;
+  if (index < 0 || index >= NNUE_MAX_NETS)
+    return 0;
+
+  if (loadedFile[index] && strcmp(evalFile, loadedFile[index]) == 0)
+    return 1;
 
-  if (loadedFile)
-    free(loadedFile);
+  if (loadedFile[index]) {
+    free(loadedFile[index]);
+    loadedFile[index] = NULL;
+  }
 
   printf("Loading NNUE : %s\n", evalFile);
   fflush(stdout);
-  if (load_eval_file(evalFile)) {
-    loadedFile = strdup(evalFile);
+  if (load_eval_file(evalFile, index)) {
+    loadedFile[index] = strdup(evalFile);
     printf("NNUE loaded !\n");
     fflush(stdout);
-    return;
+    return 1;
   }
 
   printf("NNUE file not found!\n");
   fflush(stdout);
+  return 0;
+}
+
+DLLExport void _CDECL nnue_init(const char* evalFile)
+{
+  nnue_load(0, evalFile);
+}
+
+DLLExport void _CDECL nnue_select(int index)
+{
+  net_index = index;
 }
 
 DLLExport int _CDECL nnue_evaluate(int player, int* pieces, int* squares)
 {
+  NNUEdata nnue;
+  nnue.accumulator.computedAccumulation = 0;
+
   Position pos;
+  pos.nnue[0] = &nnue;
+  pos.nnue[1] = 0;
+  pos.nnue[2] = 0;
+  pos.player = player;
+  pos.pieces = pieces;
+  pos.squares = squares;
+  return nnue_evaluate_pos(&pos);
+}
+
+DLLExport void _CDECL nnue_update_accumulator(int* pieces, int* squares, NNUEdata** nnue)
+{
+  Position pos;
+  pos.nnue[0] = nnue[0];
+  pos.nnue[1] = nnue[1];
+  pos.nnue[2] = nnue[2];
+  pos.pieces = pieces;
+  pos.squares = squares;
+
+  if (!update_accumulator(&pos))
+    refresh_accumulator(&pos);
+}
+
+DLLExport int _CDECL nnue_evaluate_incremental(int player, int* pieces, int* squares, NNUEdata** nnue)
+{
+  assert(nnue[0] && (uint64_t)(&nnue[0]->accumulator) % 64 == 0);
+
+  Position pos;
+  pos.nnue[0] = nnue[0];
+  pos.nnue[1] = nnue[1];
+  pos.nnue[2] = nnue[2];
   pos.player = player;
   pos.pieces = pieces;
   pos.squares = squares;
@@ -1306,3 +1573,24 @@ DLLExport int _CDECL nnue_evaluate_fen(const char* fen)
   decode_fen((char*)fen,&player,&castle,&fifty,&move_number,pieces,squares);;
   return nnue_evaluate(player,pieces,squares);
 }
+
+DLLExport void _CDECL nnue_evaluate_fen_batch(const char** fens, int* scores, int count)
+{
+  int pieces[33],squares[33],player,castle,fifty,move_number;
+
+  NNUEdata nnue;
+
+  Position pos;
+  pos.nnue[0] = &nnue;
+  pos.nnue[1] = 0;
+  pos.nnue[2] = 0;
+  pos.pieces = pieces;
+  pos.squares = squares;
+
+  for (int i = 0; i < count; i++) {
+    decode_fen(fens[i],&player,&castle,&fifty,&move_number,pieces,squares);
+    nnue.accumulator.computedAccumulation = 0;
+    pos.player = player;
+    scores[i] = nnue_evaluate_pos(&pos);
+  }
+}
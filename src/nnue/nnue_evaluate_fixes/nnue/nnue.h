@@ -5,6 +5,7 @@
 #include <stdalign.h>
 
 #include "misc.h"
+#include "nnue_data.h"
 
 #ifdef __cplusplus
 #   define EXTERNC extern "C"
@@ -38,41 +39,46 @@ const int pic_tab[14] = {
 #define PIECE(x)         (pic_tab[x])
 #define COMBINE(c,x)     ((x) + (c) * 6) 
 
-/*nnue data*/
-#if 0
-typedef struct DirtyPiece {
-  int dirtyNum;
-  int pc[3];
-  int from[3];
-  int to[3];
-} DirtyPiece;
-#endif
-
-typedef struct {
-  alignas(64) int16_t accumulation[2][256];
-  bool computedAccumulation;
-} Accumulator;
-
 /*position*/
 typedef struct Position {
   int player;
   int* pieces;
   int* squares;
-  Accumulator accumulator;
-#if 0
-  DirtyPiece dirtyPiece;
-#endif
+  NNUEdata* nnue[3];
 } Position;
 
 int nnue_evaluate_pos(Position* pos);
 
 /**
-* Load NNUE file
+* Max number of networks loaded at once
+*/
+#define NNUE_MAX_NETS 2
+
+/**
+* Load NNUE file as network 0
 */
 DLLExport void _CDECL nnue_init(
   const char * evalFile             /** Path to NNUE file */
 );
 
+/**
+* Load NNUE file as network 0 .. NNUE_MAX_NETS - 1
+* Returns 1 if the network is loaded.
+*/
+DLLExport int _CDECL nnue_load(
+  int net,                          /** Network index */
+  const char * evalFile             /** Path to NNUE file */
+);
+
+/**
+* Select the network the calling thread evaluates with (0 by default).
+* All the networks share the input format so accumulators can be kept
+* per ply as usual, the ones computed by another network are refreshed.
+*/
+DLLExport void _CDECL nnue_select(
+  int net                           /** Network index */
+);
+
 /**
 * Evaluate on FEN string
 */
@@ -80,6 +86,18 @@ DLLExport int _CDECL nnue_evaluate_fen(
   const char* fen                   /** FEN string to probe evaluation for */
 );
 
+/**
+* Evaluate a batch of FEN (or EPD) strings
+* -------------------------------------------------
+* Same as calling nnue_evaluate_fen() for every string but the setup is
+* done once per batch. Safe to call from several threads at once.
+*/
+DLLExport void _CDECL nnue_evaluate_fen_batch(
+  const char** fens,                /** Array of FEN strings */
+  int* scores,                      /** Array to store the scores at */
+  int count                         /** Number of FEN strings */
+);
+
 /**
 * Evaluation subroutine suitable for chess engines.
 * -------------------------------------------------
@@ -102,5 +120,36 @@ DLLExport int _CDECL nnue_evaluate(
   int* squares                      /** Corresponding array of squares the piece stand on */
 );
 
+/**
+* Incremental NNUE probe.
+* -------------------------------------------------
+* Same as nnue_evaluate() but the accumulator is kept in nnue[0] and
+* updated from the dirty pieces of nnue[0] (and nnue[1]) when the
+* accumulator of the previous position nnue[1] (or the one before that,
+* nnue[2]) is already computed. Otherwise a full refresh is done.
+*     nnue[0] current position's data
+*     nnue[1] data of the position one ply back (or NULL)
+*     nnue[2] data of the position two plies back (or NULL)
+* Dirty piece codes and squares use the same encoding as pieces/squares,
+* square 64 stands for "not on the board".
+*/
+DLLExport int _CDECL nnue_evaluate_incremental(
+  int player,                       /** Side to move */
+  int* pieces,                      /** Array of pieces */
+  int* squares,                     /** Corresponding array of squares the piece stand on */
+  NNUEdata** nnue                   /** Pointers to NNUE data of the current and two previous plies */
+);
+
+/**
+* Bring the accumulator of nnue[0] up to date without evaluating.
+* Lets the engine compute accumulators at interior nodes so that
+* positions further down the tree are only one ply away from a
+* computed accumulator. Arguments are the same as above.
+*/
+DLLExport void _CDECL nnue_update_accumulator(
+  int* pieces,                      /** Array of pieces */
+  int* squares,                     /** Corresponding array of squares the piece stand on */
+  NNUEdata** nnue                   /** Pointers to NNUE data of the current and two previous plies */
+);
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef NNUE_DATA_H
+#define NNUE_DATA_H
+
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+/**
+* Data structures shared with the engine for incremental updates.
+* Kept apart from nnue.h so engines with their own piece/color
+* enums can include them without clashing.
+*/
+typedef struct DirtyPiece {
+  int dirtyNum;
+  int pc[3];
+  int from[3];
+  int to[3];
+} DirtyPiece;
+
+typedef struct {
+  alignas(64) int16_t accumulation[2][256];
+  bool computedAccumulation;
+  int net;                          /** network the accumulation was computed with */
+} Accumulator;
+
+typedef struct {
+  Accumulator accumulator;
+  DirtyPiece dirtyPiece;
+} NNUEdata;
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+
+#define DLL_EXPORT
+#include "nnue.h"
+#undef DLL_EXPORT
+
+/*
+Runtime dispatch of the SIMD kernels.
+nnue.cpp is compiled once per SIMD level (see makefile) and the best
+variant the CPU supports is picked the first time a network is loaded.
+*/
+
+#define DECLARE_KERNEL(arch) \
+  EXTERNC void nnue_init_##arch(const char* evalFile); \
+  EXTERNC int nnue_load_##arch(int net, const char* evalFile); \
+  EXTERNC void nnue_select_##arch(int net); \
+  EXTERNC int nnue_evaluate_##arch(int player, int* pieces, int* squares); \
+  EXTERNC int nnue_evaluate_fen_##arch(const char* fen); \
+  EXTERNC void nnue_evaluate_fen_batch_##arch(const char** fens, int* scores, int count); \
+  EXTERNC int nnue_evaluate_incremental_##arch(int player, int* pieces, int* squares, NNUEdata** nnue); \
+  EXTERNC void nnue_update_accumulator_##arch(int* pieces, int* squares, NNUEdata** nnue);
+
+#define KERNEL(arch, name) { name, \
+  nnue_init_##arch, nnue_load_##arch, nnue_select_##arch, nnue_evaluate_##arch, nnue_evaluate_fen_##arch, \
+  nnue_evaluate_fen_batch_##arch, \
+  nnue_evaluate_incremental_##arch, nnue_update_accumulator_##arch }
+
+typedef struct Kernel {
+  const char *name;
+  void (*init)(const char* evalFile);
+  int (*load)(int net, const char* evalFile);
+  void (*select)(int net);
+  int (*evaluate)(int player, int* pieces, int* squares);
+  int (*evaluate_fen)(const char* fen);
+  void (*evaluate_fen_batch)(const char** fens, int* scores, int count);
+  int (*evaluate_incremental)(int player, int* pieces, int* squares, NNUEdata** nnue);
+  void (*update_accumulator)(int* pieces, int* squares, NNUEdata** nnue);
+} Kernel;
+
+#if defined(__x86_64__)
+
+DECLARE_KERNEL(avx512)
+DECLARE_KERNEL(avx2)
+DECLARE_KERNEL(sse41)
+DECLARE_KERNEL(ssse3)
+DECLARE_KERNEL(sse2)
+
+// ordered from the fastest to the slowest
+static const Kernel kernels[] = {
+  KERNEL(avx512, "AVX-512"),
+  KERNEL(avx2, "AVX2"),
+  KERNEL(sse41, "SSE4.1"),
+  KERNEL(ssse3, "SSSE3"),
+  KERNEL(sse2, "SSE2")
+};
+
+static const Kernel *select_kernel(void)
+{
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512bw")) return &kernels[0];
+  if (__builtin_cpu_supports("avx2"))     return &kernels[1];
+  if (__builtin_cpu_supports("sse4.1"))   return &kernels[2];
+  if (__builtin_cpu_supports("ssse3"))    return &kernels[3];
+  return &kernels[4];  // SSE2 is part of x86-64
+}
+
+#elif defined(__aarch64__)
+
+DECLARE_KERNEL(neon)
+
+static const Kernel kernels[] = {
+  KERNEL(neon, "NEON")  // NEON is part of AArch64
+};
+
+static const Kernel *select_kernel(void)
+{
+  return &kernels[0];
+}
+
+#else
+
+DECLARE_KERNEL(generic)
+
+static const Kernel kernels[] = {
+  KERNEL(generic, "generic")
+};
+
+static const Kernel *select_kernel(void)
+{
+  return &kernels[0];
+}
+
+#endif
+
+static const Kernel *kernel = NULL;
+
+/*
+Interfaces
+*/
+static void init_kernel(void)
+{
+  if (!kernel) {
+    kernel = select_kernel();
+    printf("info string NNUE using %s kernels\n", kernel->name);
+    fflush(stdout);
+  }
+}
+
+DLLExport void _CDECL nnue_init(const char* evalFile)
+{
+  init_kernel();
+  kernel->init(evalFile);
+}
+
+DLLExport int _CDECL nnue_load(int net, const char* evalFile)
+{
+  init_kernel();
+  return kernel->load(net, evalFile);
+}
+
+DLLExport void _CDECL nnue_select(int net)
+{
+  kernel->select(net);
+}
+
+DLLExport int _CDECL nnue_evaluate(int player, int* pieces, int* squares)
+{
+  return kernel->evaluate(player, pieces, squares);
+}
+
+DLLExport void _CDECL nnue_update_accumulator(int* pieces, int* squares, NNUEdata** nnue)
+{
+  kernel->update_accumulator(pieces, squares, nnue);
+}
+
+DLLExport int _CDECL nnue_evaluate_incremental(int player, int* pieces, int* squares, NNUEdata** nnue)
+{
+  return kernel->evaluate_incremental(player, pieces, squares, nnue);
+}
+
+DLLExport int _CDECL nnue_evaluate_fen(const char* fen)
+{
+  return kernel->evaluate_fen(fen);
+}
+
+DLLExport void _CDECL nnue_evaluate_fen_batch(const char** fens, int* scores, int count)
+{
+  kernel->evaluate_fen_batch(fens, scores, count);
+}
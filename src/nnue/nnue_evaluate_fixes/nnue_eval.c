@@ -11,17 +11,44 @@ void init_nnue(char *filename)
     nnue_init(filename);
 }
 
+// load NNUE file as network 0, 1... (returns 1 on success)
+int load_nnue(int net, char *filename)
+{
+    // call NNUE probe lib function
+    return nnue_load(net, filename);
+}
+
+// select NNUE network for the current thread
+void select_nnue(int net)
+{
+    // call NNUE probe lib function
+    nnue_select(net);
+}
+
 // get NNUE score directly
 int evaluate_nnue(int player, int *pieces, int *squares)
 {
     // call NNUE probe lib function
-    nnue_evaluate(player, pieces, squares);
+    return nnue_evaluate(player, pieces, squares);
+}
+
+// get NNUE score updating accumulators incrementally
+int evaluate_nnue_incremental(int player, int *pieces, int *squares, NNUEdata **nnue)
+{
+    // call NNUE probe lib function
+    return nnue_evaluate_incremental(player, pieces, squares, nnue);
+}
+
+// update NNUE accumulator without evaluating position
+void update_accumulator_nnue(int *pieces, int *squares, NNUEdata **nnue)
+{
+    // call NNUE probe lib function
+    nnue_update_accumulator(pieces, squares, nnue);
 }
 
 // det NNUE score from FEN input
 int evaluate_fen_nnue(char *fen)
 {
     // call NNUE probe lib function
-    nnue_evaluate_fen(fen);
+    return nnue_evaluate_fen(fen);
 }
-
@@ -1,4 +1,12 @@
 /* NNUE wrapper function headers */
+
+// include NNUE incremental update data structures
+#include "./nnue/nnue_data.h"
+
 void init_nnue(char *filename);
+int load_nnue(int net, char *filename);
+void select_nnue(int net);
 int evaluate_nnue(int player, int *pieces, int *squares);
+int evaluate_nnue_incremental(int player, int *pieces, int *squares, NNUEdata **nnue);
+void update_accumulator_nnue(int *pieces, int *squares, NNUEdata **nnue);
 int evaluate_fen_nnue(char *fen);
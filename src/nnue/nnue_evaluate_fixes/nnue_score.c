@@ -0,0 +1,333 @@
+/*
+    NNUE batch scoring tool
+
+    Reads FEN (or EPD) lines from a file or stdin and writes
+    the NNUE score of every position to stdout, one per line,
+    in the same order as the input. Empty lines and lines
+    starting with '#' are skipped.
+
+    usage: nnue_score [-t threads] [-n nnue file] [input file]
+
+    Reading, decoding and evaluation overlap: a reader thread
+    fills batches of lines, worker threads score them and the
+    main thread writes the scores out as soon as the next batch
+    in order is done.
+*/
+
+// system headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// NNUE probe lib
+#include "./nnue/nnue.h"
+
+// default NNUE file (the one embedded into the binary if any)
+#ifdef DefaultEvalFile
+#define default_nnue_file DefaultEvalFile
+#else
+#define default_nnue_file "nn-04cf2b4ed1da.nnue"
+#endif
+
+// max number of lines in a batch
+#define batch_size 1024
+
+// max length of a line (the rest is dropped)
+#define max_line_length 256
+
+// max number of worker threads
+#define max_threads 128
+
+// batch states
+enum { batch_free, batch_read, batch_scoring, batch_scored };
+
+// batch of lines
+typedef struct {
+    char lines[batch_size][max_line_length];    // FEN/EPD lines
+    const char *fens[batch_size];               // pointers to the lines
+    int scores[batch_size];                     // scores of the lines
+    int count;                                  // number of lines in the batch
+    long sequence;                              // batch index in the input
+    int state;                                  // batch state
+} batch;
+
+// batches passed between reader, workers and writer
+batch *batches;
+
+// number of batches
+int batch_count;
+
+// input stream
+FILE *input;
+
+// index of the next batch to score
+long next_batch_to_score = 0;
+
+// number of batches in the input (known once reading is done)
+long total_batches = -1;
+
+// lock & signal guarding batch states
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+
+// set batch state and wake up everyone waiting for a change
+void set_state(batch *b, int state)
+{
+    pthread_mutex_lock(&lock);
+    b->state = state;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+// read next line skipping empty and comment lines (0 at the end of input)
+int read_line(char *line)
+{
+    // loop over input lines
+    while (fgets(line, max_line_length, input))
+    {
+        // line length
+        size_t length = strlen(line);
+
+        // line is too long
+        if (length && line[length - 1] != '\n' && !feof(input))
+        {
+            // drop the rest of it
+            int c;
+            while ((c = fgetc(input)) != EOF && c != '\n');
+        }
+
+        // strip line ending
+        line[strcspn(line, "\r\n")] = 0;
+
+        // skip empty & comment lines
+        if (line[0] == 0 || line[0] == '#') continue;
+
+        // line is read
+        return 1;
+    }
+
+    // end of input
+    return 0;
+}
+
+// read input into batches
+void *reader(void *arg)
+{
+    (void)arg;
+
+    // loop over batches
+    for (long sequence = 0; ; sequence++)
+    {
+        // batch slot to fill
+        batch *b = &batches[sequence % batch_count];
+
+        // wait for the slot to be written out
+        pthread_mutex_lock(&lock);
+        while (b->state != batch_free) pthread_cond_wait(&changed, &lock);
+        pthread_mutex_unlock(&lock);
+
+        // read lines
+        b->count = 0;
+        while (b->count < batch_size && read_line(b->lines[b->count]))
+            b->count++;
+
+        // end of input
+        if (b->count == 0)
+        {
+            // let workers and writer know there's nothing left
+            pthread_mutex_lock(&lock);
+            total_batches = sequence;
+            pthread_cond_broadcast(&changed);
+            pthread_mutex_unlock(&lock);
+
+            return NULL;
+        }
+
+        // hand batch over to workers
+        b->sequence = sequence;
+        set_state(b, batch_read);
+    }
+}
+
+// score batches
+void *worker(void *arg)
+{
+    (void)arg;
+
+    // loop over batches
+    while (1)
+    {
+        // wait for the next batch to score to be read
+        pthread_mutex_lock(&lock);
+
+        batch *b = &batches[next_batch_to_score % batch_count];
+
+        while (!(b->state == batch_read && b->sequence == next_batch_to_score) &&
+               !(total_batches >= 0 && next_batch_to_score >= total_batches))
+        {
+            pthread_cond_wait(&changed, &lock);
+            b = &batches[next_batch_to_score % batch_count];
+        }
+
+        // no batches left
+        if (total_batches >= 0 && next_batch_to_score >= total_batches)
+        {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+
+        // take the batch
+        b->state = batch_scoring;
+        next_batch_to_score++;
+        pthread_mutex_unlock(&lock);
+
+        // score the batch
+        nnue_evaluate_fen_batch(b->fens, b->scores, b->count);
+
+        // hand batch over to writer
+        set_state(b, batch_scored);
+    }
+}
+
+// main driver
+int main(int argc, char *argv[])
+{
+    // init options
+    int thread_count = 1;
+    char *nnue_file = default_nnue_file;
+    char *input_file = NULL;
+
+#ifndef _WIN32
+    // use all the cores by default
+    thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    // parse command line
+    for (int index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-t") == 0 && index + 1 < argc)
+            thread_count = atoi(argv[++index]);
+
+        else if (strcmp(argv[index], "-n") == 0 && index + 1 < argc)
+            nnue_file = argv[++index];
+
+        else if (strcmp(argv[index], "-h") == 0)
+        {
+            fprintf(stderr, "usage: %s [-t threads] [-n nnue file] [input file]\n", argv[0]);
+            return 0;
+        }
+
+        else
+            input_file = argv[index];
+    }
+
+    // clamp number of threads
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > max_threads) thread_count = max_threads;
+
+    // open input
+    input = (input_file && strcmp(input_file, "-")) ? fopen(input_file, "r") : stdin;
+
+    if (input == NULL)
+    {
+        fprintf(stderr, "Couldn't open %s\n", input_file);
+        return 1;
+    }
+
+    // make sure NNUE file is there (the lib doesn't report failure)
+#ifdef NNUE_EMBEDDED
+    if (strcmp(nnue_file, default_nnue_file))
+#endif
+    {
+        FILE *nnue = fopen(nnue_file, "rb");
+
+        if (nnue == NULL)
+        {
+            fprintf(stderr, "Couldn't open %s\n", nnue_file);
+            return 1;
+        }
+
+        fclose(nnue);
+    }
+
+    // NNUE lib reports loading to stdout, keep scores the only output there
+    fflush(stdout);
+    int stdout_copy = dup(fileno(stdout));
+    dup2(fileno(stderr), fileno(stdout));
+
+    // load NNUE
+    nnue_init(nnue_file);
+
+    // restore stdout
+    fflush(stdout);
+    dup2(stdout_copy, fileno(stdout));
+    close(stdout_copy);
+
+    // one batch per worker plus one being read and one being written out
+    batch_count = thread_count + 2;
+    batches = (batch *) calloc(batch_count, sizeof(batch));
+
+    if (batches == NULL)
+    {
+        fprintf(stderr, "Couldn't allocate memory for batches\n");
+        return 1;
+    }
+
+    // init pointers to the lines
+    for (int index = 0; index < batch_count; index++)
+        for (int line = 0; line < batch_size; line++)
+            batches[index].fens[line] = batches[index].lines[line];
+
+    // start reader & worker threads
+    pthread_t reader_handle, worker_handles[max_threads];
+    pthread_create(&reader_handle, NULL, reader, NULL);
+
+    for (int id = 0; id < thread_count; id++)
+        pthread_create(&worker_handles[id], NULL, worker, NULL);
+
+    // write scores out in input order
+    for (long sequence = 0; ; sequence++)
+    {
+        // batch slot to write out
+        batch *b = &batches[sequence % batch_count];
+
+        // wait for the batch to be scored
+        pthread_mutex_lock(&lock);
+
+        while (!(b->state == batch_scored && b->sequence == sequence) &&
+               !(total_batches >= 0 && sequence >= total_batches))
+            pthread_cond_wait(&changed, &lock);
+
+        int done = total_batches >= 0 && sequence >= total_batches;
+        pthread_mutex_unlock(&lock);
+
+        // all the batches are written
+        if (done) break;
+
+        // write scores
+        for (int line = 0; line < b->count; line++)
+            printf("%d\n", b->scores[line]);
+
+        // give batch back to reader
+        set_state(b, batch_free);
+    }
+
+    // wait for threads to finish
+    pthread_join(reader_handle, NULL);
+
+    for (int id = 0; id < thread_count; id++)
+        pthread_join(worker_handles[id], NULL);
+
+    // clean up
+    if (input != stdin) fclose(input);
+    free(batches);
+
+    return 0;
+}